@@ -10,11 +10,24 @@ local ffi = require('ffi')
 local function test_instance_methods_presence(test, tuple_keydef)
         local methods = {
             'extract_key',
+            'extract_key_into',
+            'key_writer',
             'compare',
             'compare_with_key',
+            'filter',
             'merge',
             'totable',
             '__serialize',
+            'sort_permutation',
+            'hash_partition',
+            'quantiles',
+            'join',
+            'key_block',
+            'diff',
+            'build_bloom',
+            'deserialize_bloom',
+            'hll',
+            'deserialize_hll',
         }
         test:plan(#methods)
 
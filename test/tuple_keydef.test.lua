@@ -219,7 +219,8 @@ local tuple_keydef_new_cases = {
             type = 'string',
             path = '[*]',
         }},
-        exp_err = 'Multikey JSON path is not supported',
+        exp_err = nil,
+        exp_type = 'struct tuple_keydef_multikey',
         require_json_path = true,
     },
     {
@@ -267,7 +268,7 @@ local tuple_keydef_new_cases = {
 
 local test = tap.test('tuple.keydef')
 
-test:plan(#tuple_keydef_new_cases - 1 + 10)
+test:plan(#tuple_keydef_new_cases - 1 + 21)
 for _, case in ipairs(tuple_keydef_new_cases) do
     if type(case) == 'function' then
         case()
@@ -282,7 +283,7 @@ for _, case in ipairs(tuple_keydef_new_cases) do
         end
         if case.exp_err == nil then
             ok = ok and type(res) == 'cdata' and
-                ffi.istype('struct tuple_keydef', res)
+                ffi.istype(case.exp_type or 'struct tuple_keydef', res)
             test:ok(ok, case[1])
         else
             local err = tostring(res) -- cdata -> string
@@ -609,6 +610,577 @@ test:test('merge()', function(test)
         {1, 1, box.NULL, 22}, 'case 3: verify with :extract_key()')
 end)
 
+-- Case: filter().
+test:test('filter()', function(test)
+    test:plan(9)
+
+    local keydef = tuple_keydef.new({
+        {type = 'unsigned', fieldno = 2},
+        {type = 'string', fieldno = 1},
+    })
+    local tuples = {
+        box.tuple.new({'a', 1}),
+        box.tuple.new({'b', 2}),
+        {'c', 2},
+        box.tuple.new({'d', 3}),
+        box.tuple.new({'e', 4}),
+    }
+    local function names(res)
+        return fun.iter(res):map(function(t) return t[1] end):totable()
+    end
+
+    test:is_deeply(names(keydef:filter(tuples, {2}, {3})), {'b', 'c', 'd'},
+                   'GE and LE by default')
+    test:is_deeply(names(keydef:filter(tuples, {2}, {3},
+                                       {from = 'GT', to = 'LT'})),
+                   {}, 'GT and LT')
+    test:is_deeply(names(keydef:filter(tuples, {2}, nil, {from = 'EQ'})),
+                   {'b', 'c'}, 'EQ')
+    test:is_deeply(names(keydef:filter(tuples, {2, 'b'}, {4},
+                                       {from = box.index.GT,
+                                        to = box.index.LT})),
+                   {'c', 'd'}, 'box.index constants')
+    test:is_deeply(names(keydef:filter(tuples, nil, {1})), {'a'},
+                   'unbounded from the left')
+    test:is_deeply(keydef:filter(tuples, {3}, nil, {positions = true}),
+                   {4, 5}, 'positions')
+    test:is_deeply(names(keydef:filter(fun.iter(tuples), {4})), {'e'},
+                   'luafun iterator')
+
+    local i = 0
+    local function next_tuple()
+        i = i + 1
+        return tuples[i]
+    end
+    test:is_deeply(keydef:filter(next_tuple, nil, {2},
+                                 {to = 'LT', positions = true}),
+                   {1}, 'function')
+
+    local exp_err = 'from must be EQ, GE or GT'
+    local ok, err = pcall(keydef.filter, keydef, tuples, {1}, nil,
+                          {from = 'LE'})
+    test:is_deeply({ok, tostring(err)}, {false, exp_err},
+                   'wrong iterator type')
+end)
+
+-- Case: build_bloom().
+test:test('build_bloom()', function(test)
+    test:plan(11)
+
+    local keydef = tuple_keydef.new({
+        {type = 'unsigned', fieldno = 1},
+        {type = 'string', fieldno = 3},
+    })
+    local tuples = {}
+    for i = 1, 1000 do
+        table.insert(tuples, {i, 'x', tostring(i)})
+    end
+
+    local bloom = keydef:build_bloom(tuples, {fpr = 0.01})
+    test:ok(ffi.istype('struct tuple_keydef_bloom', bloom), 'type')
+
+    local all_found = true
+    for i = 1, 1000 do
+        all_found = all_found and bloom:maybe_contains({i, tostring(i)}) and
+            bloom:maybe_contains_tuple({i, 'y', tostring(i)})
+    end
+    test:ok(all_found, 'no false negatives')
+
+    local false_positives = 0
+    for i = 1001, 11000 do
+        if bloom:maybe_contains({i, tostring(i)}) then
+            false_positives = false_positives + 1
+        end
+    end
+    test:ok(false_positives < 300, 'false positive rate')
+
+    -- Integral numbers are hashed in the same way regardless of
+    -- msgpack encoding.
+    local keydef_number = tuple_keydef.new({{type = 'number', fieldno = 1}})
+    local bloom_number = keydef_number:build_bloom({{1}, {2.5}})
+    test:ok(bloom_number:maybe_contains({1.0}), 'integral double')
+    test:ok(bloom_number:maybe_contains({2.5}), 'double')
+
+    -- Decimals are hashed as equal integers or doubles.
+    local has_decimal, decimal = pcall(require, 'decimal')
+    if has_decimal then
+        local bloom_decimal = keydef_number:build_bloom({{decimal.new(3)}})
+        test:ok(bloom_decimal:maybe_contains({3}), 'decimal and integer')
+        test:ok(bloom_number:maybe_contains({decimal.new('1.00')}) and
+                bloom_number:maybe_contains({decimal.new('2.5')}),
+                'decimal with a scale')
+    else
+        test:skip('decimal and integer')
+        test:skip('decimal with a scale')
+    end
+
+    local data = bloom:serialize()
+    test:is(type(data), 'string', 'serialize')
+    local bloom_copy = keydef:deserialize_bloom(data)
+    test:is(bloom_copy:serialize(), data, 'deserialize')
+
+    local exp_err = 'Invalid Bloom filter data'
+    local ok, err = pcall(keydef.deserialize_bloom, keydef, data:sub(1, 10))
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'invalid data')
+
+    local keydef_coll = tuple_keydef.new({
+        {type = 'string', fieldno = 1, collation = 'unicode_ci'},
+    })
+    local exp_err = 'Hashing of a key part with a collation is not supported'
+    local ok, err = pcall(keydef_coll.build_bloom, keydef_coll, {})
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'collation')
+end)
+
+-- Case: extract_key_into() and key_writer().
+test:test('extract_key_into() and key_writer()', function(test)
+    test:plan(5)
+
+    local buffer = require('buffer')
+    local msgpack = require('msgpack')
+
+    local keydef = tuple_keydef.new({
+        {type = 'unsigned', fieldno = 2},
+        {type = 'string', fieldno = 1},
+    })
+    local ibuf = buffer.ibuf()
+
+    local size = keydef:extract_key_into(box.tuple.new({'a', 1, 'x'}), ibuf)
+    test:is(size, ibuf:size(), 'key size')
+    local key = msgpack.decode(ffi.string(ibuf.rpos, ibuf:size()))
+    test:is_deeply(key, {1, 'a'}, 'extract_key_into()')
+    ibuf:reset()
+
+    local writer = keydef:key_writer(ibuf, {array_header = true})
+    for i = 1, 3 do
+        writer:write({tostring(i), i})
+    end
+    test:is(writer:finish(), 3, 'finish()')
+    local keys = msgpack.decode(ffi.string(ibuf.rpos, ibuf:size()))
+    test:is_deeply(keys, {{1, '1'}, {2, '2'}, {3, '3'}},
+                   'key_writer() with an array header')
+
+    local exp_err = 'Usage: key_def:extract_key_into(tuple, ibuf)'
+    local ok, err = pcall(keydef.extract_key_into, keydef, {'a', 1}, {})
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'not an ibuf')
+end)
+
+-- Case: cooperative yielding in batch methods.
+test:test('yield_every and yield_interval options', function(test)
+    test:plan(7)
+
+    local fiber = require('fiber')
+
+    local keydef = tuple_keydef.new({{type = 'unsigned', fieldno = 1}})
+    local tuples = {}
+    for i = 1, 100 do
+        tuples[i] = box.tuple.new({i})
+    end
+
+    -- Count how many times another fiber gets control.
+    local ticks = 0
+    local ticker = fiber.new(function()
+        while true do
+            ticks = ticks + 1
+            fiber.sleep(0)
+        end
+    end)
+    fiber.sleep(0)
+
+    ticks = 0
+    local res = keydef:filter(tuples, {1}, nil, {yield_every = 10})
+    test:is(#res, 100, 'yield_every: result')
+    test:ok(ticks >= 5, 'yield_every: other fibers are run')
+
+    ticks = 0
+    local res = keydef:filter(tuples, {1}, nil, {yield_interval = 0.000001})
+    test:is(#res, 100, 'yield_interval: result')
+    test:ok(ticks >= 1, 'yield_interval: other fibers are run')
+
+    ticks = 0
+    keydef:filter(tuples, {1})
+    test:is(ticks, 0, 'no yields by default')
+
+    ticker:cancel()
+
+    local exp_err = 'yield_every must be a non-negative integer'
+    local ok, err = pcall(keydef.filter, keydef, tuples, nil, nil,
+                          {yield_every = -1})
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'invalid option')
+
+    local ok, err = pcall(keydef.filter, keydef, tuples, nil, nil,
+                          {yield_every = 0.5})
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'fractional option')
+end)
+
+-- Case: sort_permutation() and hash_partition().
+test:test('sort_permutation() and hash_partition()', function(test)
+    test:plan(11)
+
+    local msgpack = require('msgpack')
+
+    local keydef = tuple_keydef.new({
+        {type = 'unsigned', fieldno = 2},
+        {type = 'string', fieldno = 1},
+    })
+    local data = msgpack.encode({{'b', 2}, {'a', 2}, {'c', 1}, {'a', 2}})
+
+    test:is_deeply(keydef:sort_permutation(data), {3, 2, 4, 1},
+                   'sort_permutation()')
+    test:is_deeply(keydef:sort_permutation(data, {async = true}),
+                   {3, 2, 4, 1}, 'sort_permutation() in a coio thread')
+
+    local partitions = keydef:hash_partition(data, 4)
+    test:is(#partitions, 4, 'hash_partition(): a partition per tuple')
+    test:is(partitions[2], partitions[4],
+            'hash_partition(): equal keys are in the same partition')
+    test:is_deeply(keydef:hash_partition(data, 4, {async = true}),
+                   partitions, 'hash_partition() in a coio thread')
+
+    -- Tuples are compared as msgpack in a coio thread.
+    local keydef_scalar = tuple_keydef.new({
+        {type = 'scalar', fieldno = 1, is_nullable = true},
+    })
+    local data_scalar = msgpack.encode({
+        {'a'}, {2.5}, {true}, {-1}, {}, {3}, {ffi.cast('double', -1.5)},
+        {2}, {false},
+    })
+    test:is_deeply(keydef_scalar:sort_permutation(data_scalar, {async = true}),
+                   keydef_scalar:sort_permutation(data_scalar),
+                   'sort_permutation() in a coio thread: scalar')
+
+    local keydef_number = tuple_keydef.new({{type = 'number', fieldno = 1}})
+    local data_number = msgpack.encode({{1}, {ffi.cast('double', 1)}})
+    local partitions = keydef_number:hash_partition(data_number, 1000)
+    test:is(partitions[1], partitions[2],
+            'hash_partition(): 1 and 1.0 are in the same partition')
+
+    local exp_err = 'Expected a msgpack array of tuples'
+    local ok, err = pcall(keydef.sort_permutation, keydef,
+                          msgpack.encode({1, 2}))
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'invalid data')
+
+    local exp_err = 'partition_count must be a positive integer'
+    local ok, err = pcall(keydef.hash_partition, keydef, data, 2.7)
+    test:is_deeply({ok, tostring(err)}, {false, exp_err},
+                   'fractional partition_count')
+
+    if json_path_is_supported then
+        local keydef_path = tuple_keydef.new({
+            {type = 'unsigned', fieldno = 1, path = '[1]'},
+        })
+        local exp_err = 'JSON path is not supported by hash_partition()'
+        local ok, err = pcall(keydef_path.hash_partition, keydef_path,
+                              msgpack.encode({{{1}}}), 2)
+        test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'JSON path')
+
+        local exp_err = 'Sorting of a key part with a JSON path is not ' ..
+            'supported in the async mode'
+        local ok, err = pcall(keydef_path.sort_permutation, keydef_path,
+                              msgpack.encode({{{1}}}), {async = true})
+        test:is_deeply({ok, tostring(err)}, {false, exp_err},
+                       'JSON path in the async mode')
+    else
+        test:skip('JSON path')
+        test:skip('JSON path in the async mode')
+    end
+end)
+
+-- Case: quantiles().
+test:test('quantiles()', function(test)
+    test:plan(6)
+
+    local msgpack = require('msgpack')
+
+    local keydef = tuple_keydef.new({{type = 'unsigned', fieldno = 1}})
+    local tuples = {}
+    for i = 1, 1000 do
+        tuples[i] = {1001 - i}
+    end
+    local function totable(keys)
+        return fun.iter(keys):map(function(k) return k:totable() end)
+            :totable()
+    end
+
+    -- The whole input fits the sample.
+    test:is_deeply(totable(keydef:quantiles(tuples, 4)),
+                   {{251}, {501}, {751}}, 'exact quantiles')
+
+    local iter = fun.range(1, 100000):map(function(i) return {i} end)
+    local median = keydef:quantiles(iter, 2, {sample = 500, seed = 42})
+    test:ok(math.abs(median[1][1] - 50000) < 10000, 'sampled median')
+
+    local keys = keydef:quantiles(tuples, 2, {msgpack = true})
+    test:is_deeply(msgpack.decode(keys[1]), {501}, 'msgpack keys')
+
+    test:is_deeply(keydef:quantiles({}, 4), {}, 'empty input')
+
+    local exp_err = 'n must be a positive integer'
+    local ok, err = pcall(keydef.quantiles, keydef, tuples, 0)
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'invalid n')
+
+    local ok, err = pcall(keydef.quantiles, keydef, tuples, 2.9)
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'fractional n')
+end)
+
+-- Case: hll().
+test:test('hll()', function(test)
+    test:plan(8)
+
+    local keydef = tuple_keydef.new({{type = 'number', fieldno = 2}})
+
+    local hll = keydef:hll()
+    test:ok(ffi.istype('struct tuple_keydef_hll', hll), 'type')
+    test:is(hll:estimate(), 0, 'empty sketch')
+
+    -- Duplicates and integral numbers in different encodings
+    -- are counted once.
+    hll:add({'a', 1})
+    hll:add(box.tuple.new({'b', 1.0}))
+    hll:add({'c', 2.5})
+    test:is(math.floor(hll:estimate() + 0.5), 2, 'add()')
+
+    local iter = fun.range(1, 100000):map(function(i) return {'x', i} end)
+    hll:add_many(iter, {yield_every = 1000})
+    test:ok(math.abs(hll:estimate() - 100000) < 3000, 'add_many()')
+
+    -- Sketches of intersecting sets from two shards.
+    local hll_1 = keydef:hll({precision = 12})
+    local hll_2 = keydef:hll({precision = 12})
+    hll_1:add_many(fun.range(1, 6000):map(function(i) return {'x', i} end))
+    hll_2:add_many(fun.range(4001, 10000):map(function(i) return {'x', i} end))
+    hll_1:merge(hll_2)
+    test:ok(math.abs(hll_1:estimate() - 10000) < 1000, 'merge()')
+
+    local copy = keydef:deserialize_hll(hll_1:serialize())
+    test:is(copy:estimate(), hll_1:estimate(), 'serialize() and deserialize()')
+
+    local exp_err = "Can't merge sketches with different precision: 14 and 12"
+    local ok, err = pcall(hll.merge, hll, hll_1)
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'precision mismatch')
+
+    local exp_err = 'precision must be an integer in [4, 18]'
+    local errs = fun.iter({19, -1, 4.5, 0 / 0}):map(function(precision)
+        local ok, err = pcall(keydef.hll, keydef, {precision = precision})
+        return {ok, tostring(err)}
+    end):totable()
+    test:is_deeply(errs, fun.duplicate({false, exp_err}):take(4):totable(),
+                   'invalid precision')
+end)
+
+-- Case: join().
+test:test('join()', function(test)
+    test:plan(9)
+
+    -- The join fields are at different positions.
+    local left_kd = tuple_keydef.new({{type = 'unsigned', fieldno = 2}})
+    local right_kd = tuple_keydef.new({
+        {type = 'unsigned', fieldno = 1, is_nullable = true},
+    })
+    local left = {{'a', 1}, {'b', 2}, {'c', 2}, {'d', 4}, {'e', 5}}
+    local right = {{2, 'x'}, {2, 'y'}, {3, 'z'}, {5, 'w'}}
+    local function totable(pairs)
+        return fun.iter(pairs):map(function(p)
+            return {p[1][1], p[2] ~= nil and p[2][2] or box.NULL}
+        end):totable()
+    end
+
+    test:is_deeply(totable(left_kd:join(right_kd, left, right)), {
+        {'b', 'x'}, {'b', 'y'}, {'c', 'x'}, {'c', 'y'}, {'e', 'w'},
+    }, 'inner join')
+
+    local res = left_kd:join(right_kd, left, right, {mode = 'left'})
+    test:is_deeply(totable(res), {
+        {'a', box.NULL}, {'b', 'x'}, {'b', 'y'}, {'c', 'x'}, {'c', 'y'},
+        {'d', box.NULL}, {'e', 'w'},
+    }, 'left outer join')
+    test:ok(box.tuple.is(res[1][1]), 'tuples are returned')
+
+    local iter = fun.range(1, 1000):map(function(i) return {'x', i} end)
+    local res = left_kd:join(right_kd, iter, fun.iter(right),
+                             {yield_every = 10})
+    test:is(#res, 4, 'iterators')
+
+    -- The inner join stops, when the right input is exhausted.
+    local calls = 0
+    local function left_gen()
+        calls = calls + 1
+        return calls <= 1000 and {'x', calls} or nil
+    end
+    left_kd:join(right_kd, left_gen, {{1, 'y'}})
+    test:is(calls, 2, 'inner join stops at the end of the right input')
+
+    local exp_err = 'Tuples are not sorted: see tuple 2 of left'
+    local ok, err = pcall(left_kd.join, left_kd, right_kd,
+                          {{'a', 2}, {'b', 1}}, {{1, 'x'}, {2, 'y'}})
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'unsorted left')
+
+    local exp_err = 'Tuples are not sorted: see tuple 2 of right'
+    local ok, err = pcall(left_kd.join, left_kd, right_kd,
+                          {{'a', 1}, {'b', 2}}, {{2, 'x'}, {1, 'y'}})
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'unsorted right')
+
+    local right_kd_str = tuple_keydef.new({{type = 'string', fieldno = 1}})
+    local exp_err = 'Join key part 1 has different types: unsigned and string'
+    local ok, err = pcall(left_kd.join, left_kd, right_kd_str, left, right)
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'incompatible types')
+
+    local exp_err = "mode must be 'inner' or 'left'"
+    local ok, err = pcall(left_kd.join, left_kd, right_kd, left, right,
+                          {mode = 'full'})
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'invalid mode')
+end)
+
+-- Case: key_block().
+test:test('key_block()', function(test)
+    test:plan(12)
+
+    local keydef = tuple_keydef.new({
+        {type = 'string', fieldno = 2},
+        {type = 'unsigned', fieldno = 1},
+    })
+    local tuples = {}
+    for i = 1000, 1, -1 do
+        table.insert(tuples, {i, ('key_%04d'):format(i % 500)})
+    end
+
+    local block = keydef:key_block(tuples, {restart_interval = 4,
+                                            block_size = 256})
+    test:ok(ffi.istype('struct tuple_keydef_key_block', block), 'type')
+    test:is(block:len(), 1000, 'len()')
+    test:is_deeply(block:get(1):totable(), {'key_0000', 500}, 'get()')
+    test:is(block:get(1001), nil, 'get(): out of range')
+    test:is(block:lower_bound({'key_0100', 101}), 202, 'lower_bound()')
+    test:is(block:lower_bound({'key_0100'}), 201, 'lower_bound(): partial')
+    test:is(block:find({'key_0100', 600}), 202, 'find()')
+    test:is(block:find({'key_0100', 102}), nil, 'find(): absent')
+
+    local key_keydef = tuple_keydef.new({
+        {type = 'string', fieldno = 1},
+        {type = 'unsigned', fieldno = 2},
+    })
+    local prev
+    local count = 0
+    local sorted = true
+    for _, key in block:pairs() do
+        sorted = sorted and
+            (prev == nil or key_keydef:compare(prev, key) <= 0)
+        prev = key
+        count = count + 1
+    end
+    test:ok(sorted and count == 1000, 'pairs()')
+
+    local iter = fun.range(1, 1000):map(function(i)
+        return {i, ('key_%04d'):format(i)}
+    end)
+    local block = keydef:key_block(iter, {sorted = true})
+    test:ok(block:bytes_per_key() < 12, 'bytes_per_key()')
+
+    local exp_err = 'Tuples are not sorted: see tuple 2'
+    local ok, err = pcall(keydef.key_block, keydef, {{2, 'b'}, {1, 'a'}},
+                          {sorted = true})
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'unsorted input')
+
+    local exp_err = 'restart_interval must be a positive integer'
+    local ok, err = pcall(keydef.key_block, keydef, tuples,
+                          {restart_interval = 1.5})
+    test:is_deeply({ok, tostring(err)}, {false, exp_err},
+                   'fractional restart_interval')
+end)
+
+-- Case: diff().
+test:test('diff()', function(test)
+    test:plan(8)
+
+    local kd = tuple_keydef.new({{type = 'unsigned', fieldno = 1}})
+    local old = {{1, 'a'}, {2, 'b'}, {3, 'c'}, {5, 'e'}}
+    local new = {{2, 'b'}, {3, 'x'}, {4, 'd'}, {5, 'e', 'f'}, {6, 'g'}}
+    local function keys(tuples)
+        return fun.iter(tuples):map(function(t) return t[1] end):totable()
+    end
+
+    local res = kd:diff(old, new)
+    test:is_deeply(keys(res.inserted), {4, 6}, 'inserted')
+    test:is_deeply(keys(res.deleted), {1}, 'deleted')
+    test:is_deeply(fun.iter(res.changed):map(function(p)
+        return {p[1]:totable(), p[2]:totable()}
+    end):totable(), {
+        {{3, 'c'}, {3, 'x'}}, {{5, 'e'}, {5, 'e', 'f'}},
+    }, 'changed')
+
+    local events = {}
+    local res = kd:diff(fun.iter(old), fun.iter(new), {
+        callback = function(kind, o, n)
+            table.insert(events, {kind, o ~= nil and o[1] or box.NULL,
+                                  n ~= nil and n[1] or box.NULL})
+        end,
+        yield_every = 2,
+    })
+    test:is(res, nil, 'nothing is returned with a callback')
+    test:is_deeply(events, {
+        {'deleted', 1, box.NULL}, {'changed', 3, 3},
+        {'inserted', box.NULL, 4}, {'changed', 5, 5},
+        {'inserted', box.NULL, 6},
+    }, 'callback')
+
+    local exp_err = 'callback must be a function'
+    local ok, err = pcall(kd.diff, kd, old, new, {callback = 1})
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'invalid callback')
+
+    local exp_err = 'Tuples are not sorted: see tuple 2 of new'
+    local ok, err = pcall(kd.diff, kd, old, {{2}, {1}})
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'unsorted input')
+
+    local exp_err = 'Tuples are not sorted: see tuple 3 of old'
+    local ok, err = pcall(kd.diff, kd, {{1}, {2}, {2}}, new)
+    test:is_deeply({ok, tostring(err)}, {false, exp_err}, 'duplicate keys')
+end)
+
+-- Case: multikey JSON path.
+test:test('extract_keys_multikey() and compare_with_key_multikey()',
+          function(test)
+    test:plan(8)
+
+    if not json_path_is_supported then
+        for i = 1, 8 do
+            test:skip('multikey JSON path')
+        end
+        return
+    end
+
+    local keydef = tuple_keydef.new({
+        {type = 'string', fieldno = 2, path = 'tags[*].name'},
+        {type = 'unsigned', fieldno = 1},
+    })
+    test:ok(ffi.istype('struct tuple_keydef_multikey', keydef), 'type')
+    test:is(keydef.compare, nil, 'no methods unsupported for multikey')
+
+    local tuple = box.tuple.new({7, {tags = {
+        {name = 'c'}, {name = 'a'}, {name = 'b'},
+    }}})
+    local keys = fun.iter(keydef:extract_keys_multikey(tuple))
+        :map(function(k) return k:totable() end):totable()
+    test:is_deeply(keys, {{'c', 7}, {'a', 7}, {'b', 7}},
+                   'extract_keys_multikey()')
+    test:is_deeply(keydef:extract_keys_multikey({7, {tags = {}}}), {},
+                   'extract_keys_multikey(): empty array')
+
+    test:is_deeply({keydef:compare_with_key_multikey(tuple, {'b', 7})},
+                   {0, 3}, 'compare_with_key_multikey(): equal element')
+    test:is_deeply({keydef:compare_with_key_multikey(tuple, {'aa'})},
+                   {1, 3}, 'compare_with_key_multikey(): least greater')
+    test:is_deeply({keydef:compare_with_key_multikey(tuple, {'d'})},
+                   {-1, 1}, 'compare_with_key_multikey(): greatest')
+
+    -- A numeric token is looked up in a map as a string key.
+    local keydef_map = tuple_keydef.new({
+        {type = 'unsigned', fieldno = 1, path = '[1][*]'},
+    })
+    local keys = fun.iter(keydef_map:extract_keys_multikey({
+        {['1'] = {5, 6}, [1] = {9}},
+    })):map(function(k) return k:totable() end):totable()
+    test:is_deeply(keys, {{5}, {6}}, 'numeric token on a map')
+end)
+
 test:test('JSON path is not supported error', function(test)
     test:plan(1)
 
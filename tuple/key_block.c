@@ -0,0 +1,348 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "key_block.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t
+varint32_sizeof(uint32_t value)
+{
+	uint32_t size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		++size;
+	}
+	return size;
+}
+
+static char *
+varint32_encode(char *data, uint32_t value)
+{
+	while (value >= 0x80) {
+		*data++ = (char)(value | 0x80);
+		value >>= 7;
+	}
+	*data++ = (char)value;
+	return data;
+}
+
+static uint32_t
+varint32_decode(const char **data)
+{
+	const uint8_t *p = (const uint8_t *)*data;
+	uint32_t value = 0;
+	for (uint32_t shift = 0; ; shift += 7) {
+		uint8_t byte = *p++;
+		value |= (uint32_t)(byte & 0x7f) << shift;
+		if (byte < 0x80)
+			break;
+	}
+	*data = (const char *)p;
+	return value;
+}
+
+/** Grow a buffer to fit at least @a size bytes. */
+static int
+buffer_reserve(void **buf, uint32_t *capacity, uint32_t size)
+{
+	if (size <= *capacity)
+		return 0;
+	uint32_t new_capacity = *capacity > 0 ? *capacity : 64;
+	while (new_capacity < size)
+		new_capacity *= 2;
+	void *new_buf = realloc(*buf, new_capacity);
+	if (new_buf == NULL)
+		return -1;
+	*buf = new_buf;
+	*capacity = new_capacity;
+	return 0;
+}
+
+void
+key_block_set_create(struct key_block_set *set, uint32_t restart_interval,
+		     uint32_t block_size)
+{
+	assert(restart_interval > 0);
+	memset(set, 0, sizeof(*set));
+	set->restart_interval = restart_interval;
+	set->block_size = block_size;
+}
+
+void
+key_block_set_destroy(struct key_block_set *set)
+{
+	for (uint32_t i = 0; i < set->block_count; ++i) {
+		if (! set->is_building || i != set->block_count - 1)
+			free(set->blocks[i].data);
+	}
+	free(set->blocks);
+	free(set->last_key);
+	free(set->buf);
+	free(set->restarts);
+	memset(set, 0, sizeof(*set));
+}
+
+/** Size of a block data, restart points are 4 byte aligned. */
+static size_t
+key_block_data_size(uint32_t size, uint32_t restart_count)
+{
+	return ((size + 3) & ~(size_t)3) + restart_count * sizeof(uint32_t);
+}
+
+/** Copy the last block out of the build buffers. */
+static int
+key_block_set_seal(struct key_block_set *set)
+{
+	assert(set->is_building);
+	struct key_block *block = &set->blocks[set->block_count - 1];
+	size_t size = key_block_data_size(block->size, block->restart_count);
+	char *data = malloc(size);
+	if (data == NULL)
+		return -1;
+	memcpy(data, set->buf, block->size);
+	uint32_t *restarts = (uint32_t *)(data + size -
+		block->restart_count * sizeof(uint32_t));
+	memcpy(restarts, set->restarts,
+	       block->restart_count * sizeof(uint32_t));
+	block->data = data;
+	block->restarts = restarts;
+	set->memory += size;
+	set->is_building = false;
+	return 0;
+}
+
+/** Start a new block. */
+static int
+key_block_set_start(struct key_block_set *set)
+{
+	assert(! set->is_building);
+	if (set->block_count == set->block_capacity) {
+		uint32_t capacity = set->block_capacity > 0 ?
+				    set->block_capacity * 2 : 16;
+		struct key_block *blocks = realloc(set->blocks,
+			capacity * sizeof(*blocks));
+		if (blocks == NULL)
+			return -1;
+		set->blocks = blocks;
+		set->block_capacity = capacity;
+	}
+	struct key_block *block = &set->blocks[set->block_count++];
+	memset(block, 0, sizeof(*block));
+	block->first = set->key_count;
+	/* Refer the build buffer until the block is sealed. */
+	block->data = set->buf;
+	set->is_building = true;
+	return 0;
+}
+
+int
+key_block_set_add(struct key_block_set *set, const char *key,
+		  uint32_t key_size)
+{
+	if (! set->is_building && key_block_set_start(set) != 0)
+		return -1;
+	struct key_block *block = &set->blocks[set->block_count - 1];
+
+	bool is_restart = block->key_count % set->restart_interval == 0;
+	uint32_t shared = 0;
+	if (! is_restart) {
+		uint32_t max = set->last_key_size < key_size ?
+			       set->last_key_size : key_size;
+		while (shared < max && set->last_key[shared] == key[shared])
+			++shared;
+	}
+	uint32_t entry_size = varint32_sizeof(shared) +
+			      varint32_sizeof(key_size - shared) +
+			      key_size - shared;
+	uint32_t restart_count = block->restart_count + is_restart;
+	if (block->key_count > 0 &&
+	    key_block_data_size(block->size + entry_size, restart_count) >
+	    set->block_size) {
+		if (key_block_set_seal(set) != 0 ||
+		    key_block_set_start(set) != 0)
+			return -1;
+		block = &set->blocks[set->block_count - 1];
+		is_restart = true;
+		shared = 0;
+		entry_size = varint32_sizeof(0) + varint32_sizeof(key_size) +
+			     key_size;
+	}
+
+	uint32_t restarts_size = (block->restart_count + 1) * sizeof(uint32_t);
+	if (buffer_reserve((void **)&set->buf, &set->buf_capacity,
+			   block->size + entry_size) != 0 ||
+	    buffer_reserve((void **)&set->restarts, &set->restarts_capacity,
+			   restarts_size) != 0 ||
+	    buffer_reserve((void **)&set->last_key, &set->last_key_capacity,
+			   key_size) != 0)
+		return -1;
+	block->data = set->buf;
+	if (is_restart)
+		set->restarts[block->restart_count++] = block->size;
+	char *p = set->buf + block->size;
+	p = varint32_encode(p, shared);
+	p = varint32_encode(p, key_size - shared);
+	memcpy(p, key + shared, key_size - shared);
+	block->size += entry_size;
+	memcpy(set->last_key, key, key_size);
+	set->last_key_size = key_size;
+	++block->key_count;
+	++set->key_count;
+	if (key_size > set->key_size_max)
+		set->key_size_max = key_size;
+	return 0;
+}
+
+int
+key_block_set_finish(struct key_block_set *set)
+{
+	if (set->is_building && key_block_set_seal(set) != 0)
+		return -1;
+	free(set->last_key);
+	free(set->buf);
+	free(set->restarts);
+	set->last_key = NULL;
+	set->buf = NULL;
+	set->restarts = NULL;
+	set->last_key_capacity = 0;
+	set->buf_capacity = 0;
+	set->restarts_capacity = 0;
+	if (set->block_count > 0 && set->block_count < set->block_capacity) {
+		struct key_block *blocks = realloc(set->blocks,
+			set->block_count * sizeof(*blocks));
+		if (blocks != NULL) {
+			set->blocks = blocks;
+			set->block_capacity = set->block_count;
+		}
+	}
+	set->memory += set->block_capacity * sizeof(struct key_block);
+	return 0;
+}
+
+/**
+ * Decode a key at @a offset of a block. @a buf holds the
+ * previous key.
+ */
+static uint32_t
+key_block_decode(const struct key_block *block, uint32_t *offset, char *buf)
+{
+	const char *p = block->data + *offset;
+	uint32_t shared = varint32_decode(&p);
+	uint32_t unshared = varint32_decode(&p);
+	memcpy(buf + shared, p, unshared);
+	*offset = p + unshared - block->data;
+	return shared + unshared;
+}
+
+/** Get a key of a restart point without a copying. */
+static const char *
+key_block_restart_key(const struct key_block *block, uint32_t restart,
+		      uint32_t *key_size)
+{
+	const char *p = block->data + block->restarts[restart];
+	uint32_t shared = varint32_decode(&p);
+	assert(shared == 0);
+	(void)shared;
+	*key_size = varint32_decode(&p);
+	return p;
+}
+
+uint32_t
+key_block_set_get(const struct key_block_set *set, uint32_t pos, char *buf)
+{
+	assert(! set->is_building);
+	assert(pos < set->key_count);
+	/* Find the last block, which starts not after pos. */
+	uint32_t lo = 0;
+	uint32_t hi = set->block_count;
+	while (hi - lo > 1) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (set->blocks[mid].first <= pos)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	const struct key_block *block = &set->blocks[lo];
+	uint32_t i = pos - block->first;
+	uint32_t offset = block->restarts[i / set->restart_interval];
+	uint32_t key_size = 0;
+	for (uint32_t j = 0; j <= i % set->restart_interval; ++j)
+		key_size = key_block_decode(block, &offset, buf);
+	return key_size;
+}
+
+uint32_t
+key_block_set_lower_bound(const struct key_block_set *set,
+			  key_block_cmp_f cmp, void *arg, char *buf)
+{
+	assert(! set->is_building);
+	const char *key;
+	uint32_t key_size;
+	/* Count blocks, which first key is less. */
+	uint32_t lo = 0;
+	uint32_t hi = set->block_count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		key = key_block_restart_key(&set->blocks[mid], 0, &key_size);
+		if (cmp(key, key_size, arg) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return 0;
+	const struct key_block *block = &set->blocks[lo - 1];
+
+	/* Count restart points, which key is less. */
+	lo = 1;
+	hi = block->restart_count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		key = key_block_restart_key(block, mid, &key_size);
+		if (cmp(key, key_size, arg) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	uint32_t i = (lo - 1) * set->restart_interval;
+	uint32_t offset = block->restarts[lo - 1];
+	for (; i < block->key_count; ++i) {
+		key_size = key_block_decode(block, &offset, buf);
+		if (cmp(buf, key_size, arg) >= 0)
+			break;
+	}
+	return block->first + i;
+}
@@ -0,0 +1,156 @@
+#ifndef TUPLE_KEYDEF_KEY_BLOCK_H_INCLUDED
+#define TUPLE_KEYDEF_KEY_BLOCK_H_INCLUDED
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* defined(__cplusplus) */
+
+/**
+ * Sorted keys stored in prefix compressed blocks.
+ *
+ * A key is stored as the length of a prefix it shares with the
+ * previous key, the length of the rest and the rest itself (the
+ * lengths are varints). Each restart_interval-th key of a block
+ * is stored in full: it is a restart point.
+ *
+ * A search goes over first keys of blocks and then over restart
+ * points of a block using binary search. After that at most
+ * restart_interval keys are decoded.
+ *
+ * Keys are opaque byte strings here: a caller provides a
+ * comparator, which must agree with the order of added keys.
+ */
+
+struct key_block {
+	/** Encoded keys followed by restart point offsets. */
+	char *data;
+	/** Size of the encoded keys. */
+	uint32_t size;
+	/** Position of the first key of the block in the set. */
+	uint32_t first;
+	uint32_t key_count;
+	/** Offsets of restart points in data. */
+	uint32_t *restarts;
+	uint32_t restart_count;
+};
+
+struct key_block_set {
+	uint32_t restart_interval;
+	/**
+	 * A block is sealed, when the next key does not fit this
+	 * size. A key larger than the size occupies a block alone.
+	 */
+	uint32_t block_size;
+	struct key_block *blocks;
+	uint32_t block_count;
+	uint32_t block_capacity;
+	uint32_t key_count;
+	/** Size of the longest key. */
+	uint32_t key_size_max;
+	/** Memory occupied by the blocks. */
+	size_t memory;
+	/** Whether the last block accepts keys. */
+	bool is_building;
+	/** The last added key. */
+	char *last_key;
+	uint32_t last_key_size;
+	uint32_t last_key_capacity;
+	/** Encoded keys of the last block. */
+	char *buf;
+	uint32_t buf_capacity;
+	/** Restart points of the last block. */
+	uint32_t *restarts;
+	uint32_t restarts_capacity;
+};
+
+/**
+ * Comparator of a stored key with a searched one. Returns
+ * a negative value, when the stored key is less.
+ */
+typedef int (*key_block_cmp_f)(const char *key, uint32_t key_size,
+			       void *arg);
+
+void
+key_block_set_create(struct key_block_set *set, uint32_t restart_interval,
+		     uint32_t block_size);
+
+void
+key_block_set_destroy(struct key_block_set *set);
+
+/**
+ * Append a key. Keys must be added in the sorted order.
+ *
+ * Return 0 on success, -1 on memory allocation error.
+ */
+int
+key_block_set_add(struct key_block_set *set, const char *key,
+		  uint32_t key_size);
+
+/**
+ * Seal the last block and free the build buffers. No keys can
+ * be added after this call.
+ *
+ * Return 0 on success, -1 on memory allocation error.
+ */
+int
+key_block_set_finish(struct key_block_set *set);
+
+/**
+ * Decode a key at zero based position @a pos into @a buf, which
+ * must fit key_size_max bytes.
+ *
+ * Return the key size.
+ */
+uint32_t
+key_block_set_get(const struct key_block_set *set, uint32_t pos, char *buf);
+
+/**
+ * Find the position of the first key, which is not less than
+ * a searched one according to @a cmp. key_count is returned,
+ * when all keys are less.
+ *
+ * @a buf must fit key_size_max bytes.
+ */
+uint32_t
+key_block_set_lower_bound(const struct key_block_set *set,
+			  key_block_cmp_f cmp, void *arg, char *buf);
+
+#if defined(__cplusplus)
+} /* extern "C" */
+#endif /* defined(__cplusplus) */
+
+#endif /* TUPLE_KEYDEF_KEY_BLOCK_H_INCLUDED */
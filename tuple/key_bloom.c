@@ -0,0 +1,127 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "key_bloom.h"
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "key_hash.h"
+
+enum { KEY_BLOOM_BLOCK_BITS = KEY_BLOOM_BLOCK_SIZE * 8 };
+
+/**
+ * Bits per key for a blocked filter is a bit more than for a
+ * classic one to achieve the same false positive rate: keys are
+ * spread over blocks unevenly.
+ */
+static const double KEY_BLOOM_BLOCK_OVERHEAD = 1.1;
+
+int
+key_bloom_geometry(uint32_t key_count, double fpr, uint32_t *block_count,
+		   uint32_t *hash_count)
+{
+	assert(fpr > 0 && fpr < 1);
+	double ln2 = log(2);
+	double bits_per_key = -log(fpr) / (ln2 * ln2) *
+			      KEY_BLOOM_BLOCK_OVERHEAD;
+	*hash_count = (uint32_t)round(bits_per_key * ln2);
+	if (*hash_count < 1)
+		*hash_count = 1;
+	if (*hash_count > KEY_BLOOM_HASH_COUNT_MAX)
+		*hash_count = KEY_BLOOM_HASH_COUNT_MAX;
+	double blocks = ceil(bits_per_key * key_count / KEY_BLOOM_BLOCK_BITS);
+	if (blocks < 1)
+		blocks = 1;
+	if (blocks > KEY_BLOOM_BLOCK_COUNT_MAX)
+		return -1;
+	*block_count = (uint32_t)blocks;
+	return 0;
+}
+
+int
+key_bloom_create_raw(struct key_bloom *bloom, uint32_t block_count,
+		     uint32_t hash_count)
+{
+	bloom->block_count = block_count;
+	bloom->hash_count = hash_count;
+	bloom->data = calloc(block_count, KEY_BLOOM_BLOCK_SIZE);
+	return bloom->data == NULL ? -1 : 0;
+}
+
+void
+key_bloom_destroy(struct key_bloom *bloom)
+{
+	free(bloom->data);
+	bloom->data = NULL;
+}
+
+/**
+ * Find a block for a hash and a base and a step for bit
+ * positions within it (double hashing).
+ *
+ * The block is chosen by high bits of the hash, while bit
+ * positions are derived from low bits and from a remixed hash
+ * to don't correlate with the block choice.
+ */
+static inline uint8_t *
+key_bloom_block(const struct key_bloom *bloom, uint64_t hash,
+		uint32_t *base, uint32_t *step)
+{
+	uint64_t block_no = ((hash >> 32) * bloom->block_count) >> 32;
+	*base = (uint32_t)hash;
+	*step = (uint32_t)key_hash_fmix(hash) | 1;
+	return bloom->data + block_no * KEY_BLOOM_BLOCK_SIZE;
+}
+
+void
+key_bloom_add(struct key_bloom *bloom, uint64_t hash)
+{
+	uint32_t base, step;
+	uint8_t *block = key_bloom_block(bloom, hash, &base, &step);
+	for (uint32_t i = 0; i < bloom->hash_count; ++i) {
+		uint32_t bit = (base + i * step) % KEY_BLOOM_BLOCK_BITS;
+		block[bit / 8] |= 1 << (bit % 8);
+	}
+}
+
+bool
+key_bloom_maybe_has(const struct key_bloom *bloom, uint64_t hash)
+{
+	uint32_t base, step;
+	uint8_t *block = key_bloom_block(bloom, hash, &base, &step);
+	for (uint32_t i = 0; i < bloom->hash_count; ++i) {
+		uint32_t bit = (base + i * step) % KEY_BLOOM_BLOCK_BITS;
+		if ((block[bit / 8] & (1 << (bit % 8))) == 0)
+			return false;
+	}
+	return true;
+}
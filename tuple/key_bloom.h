@@ -0,0 +1,118 @@
+#ifndef TUPLE_KEYDEF_KEY_BLOOM_H_INCLUDED
+#define TUPLE_KEYDEF_KEY_BLOOM_H_INCLUDED
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* defined(__cplusplus) */
+
+/**
+ * Blocked Bloom filter over key hashes (see key_hash.h).
+ *
+ * All bits of a key are set within one cache line sized block,
+ * so a lookup touches one cache line regardless of the number
+ * of hash functions.
+ *
+ * The bit array is a plain byte array, so it may be stored and
+ * loaded on a platform with another byte order.
+ */
+
+/** Size of a block in bytes. */
+enum { KEY_BLOOM_BLOCK_SIZE = 64 };
+
+/** Maximal number of bits set per key. */
+enum { KEY_BLOOM_HASH_COUNT_MAX = 16 };
+
+struct key_bloom {
+	/** Number of blocks. */
+	uint32_t block_count;
+	/** Number of bits set per key. */
+	uint32_t hash_count;
+	/** The bit array: block_count * KEY_BLOOM_BLOCK_SIZE. */
+	uint8_t *data;
+};
+
+/**
+ * Maximal number of blocks: size of the bit array fits 32 bits.
+ */
+enum { KEY_BLOOM_BLOCK_COUNT_MAX = UINT32_MAX / KEY_BLOOM_BLOCK_SIZE };
+
+/**
+ * Calculate geometry of a filter for @a key_count keys with the
+ * given false positive rate.
+ *
+ * Return 0 on success, -1 when the filter would have more than
+ * KEY_BLOOM_BLOCK_COUNT_MAX blocks.
+ */
+int
+key_bloom_geometry(uint32_t key_count, double fpr, uint32_t *block_count,
+		   uint32_t *hash_count);
+
+/**
+ * Allocate a filter with the given geometry. The bit array is
+ * zeroed.
+ *
+ * Return 0 on success, -1 on memory allocation error.
+ */
+int
+key_bloom_create_raw(struct key_bloom *bloom, uint32_t block_count,
+		     uint32_t hash_count);
+
+void
+key_bloom_destroy(struct key_bloom *bloom);
+
+/** Size of the bit array in bytes. */
+static inline size_t
+key_bloom_data_size(const struct key_bloom *bloom)
+{
+	return (size_t)bloom->block_count * KEY_BLOOM_BLOCK_SIZE;
+}
+
+void
+key_bloom_add(struct key_bloom *bloom, uint64_t hash);
+
+/**
+ * Whether a key with the given hash may be added to the filter.
+ * False means that the key was definitely not added.
+ */
+bool
+key_bloom_maybe_has(const struct key_bloom *bloom, uint64_t hash);
+
+#if defined(__cplusplus)
+} /* extern "C" */
+#endif /* defined(__cplusplus) */
+
+#endif /* TUPLE_KEYDEF_KEY_BLOOM_H_INCLUDED */
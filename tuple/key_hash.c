@@ -0,0 +1,347 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "key_hash.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <msgpuck.h>
+
+/** Kinds of values, which are mixed into a hash. */
+enum key_hash_tag {
+	KEY_HASH_TAG_NIL = 1,
+	KEY_HASH_TAG_BOOL,
+	KEY_HASH_TAG_UINT,
+	KEY_HASH_TAG_NEG_INT,
+	KEY_HASH_TAG_DOUBLE,
+	KEY_HASH_TAG_STR,
+	KEY_HASH_TAG_BIN,
+	KEY_HASH_TAG_EXT,
+	KEY_HASH_TAG_RAW,
+	KEY_HASH_TAG_DECIMAL,
+};
+
+/** MP_EXT type of a decimal. */
+enum { MP_EXT_DECIMAL = 1 };
+
+/**
+ * Max number of digits of a decimal, which is normalized by
+ * key_hash_decimal(). Tarantool's decimals have at most 38.
+ */
+enum { KEY_HASH_DECIMAL_DIGITS_MAX = 64 };
+
+/**
+ * Max number of significant digits of a decimal, which may be
+ * equal to a double: tarantool converts a double to a decimal
+ * with DBL_DIG digits to compare them.
+ */
+enum { KEY_HASH_DECIMAL_DBL_DIG = 15 };
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * Mix a 64 bit word into a hash: a round of MurmurHash3.
+ */
+static inline uint64_t
+key_hash_mix(uint64_t h, uint64_t k)
+{
+	k *= 0x87c37b91114253d5ULL;
+	k = rotl64(k, 31);
+	k *= 0x4cf5ad432745937fULL;
+	h ^= k;
+	h = rotl64(h, 27);
+	return h * 5 + 0x52dce729;
+}
+
+/**
+ * Load 8 bytes as a little endian word regardless of the
+ * platform byte order.
+ */
+static inline uint64_t
+load_le64(const char *p)
+{
+	uint64_t k;
+	memcpy(&k, p, sizeof(k));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	k = __builtin_bswap64(k);
+#endif
+	return k;
+}
+
+static uint64_t
+key_hash_bytes(uint64_t h, const char *data, uint32_t len)
+{
+	const char *end = data + len;
+	for (; end - data >= 8; data += 8)
+		h = key_hash_mix(h, load_le64(data));
+	uint64_t tail = 0;
+	for (int shift = 0; data < end; ++data, shift += 8)
+		tail |= (uint64_t)(unsigned char)*data << shift;
+	h = key_hash_mix(h, tail);
+	return key_hash_mix(h, len);
+}
+
+/**
+ * Hash an integral number: unsigned and non-negative signed
+ * values share the same tag.
+ */
+static inline uint64_t
+key_hash_int(uint64_t h, int64_t value)
+{
+	if (value >= 0)
+		h = key_hash_mix(h, KEY_HASH_TAG_UINT);
+	else
+		h = key_hash_mix(h, KEY_HASH_TAG_NEG_INT);
+	return key_hash_mix(h, (uint64_t)value);
+}
+
+static uint64_t
+key_hash_double(uint64_t h, double value)
+{
+	/*
+	 * An integral value is hashed as an integer to match the
+	 * same integer encoded as MP_UINT or MP_INT.
+	 */
+	if (value >= 0 && value < 18446744073709551616.0 &&
+	    value == floor(value)) {
+		h = key_hash_mix(h, KEY_HASH_TAG_UINT);
+		return key_hash_mix(h, (uint64_t)value);
+	}
+	if (value < 0 && value >= -9223372036854775808.0 &&
+	    value == floor(value))
+		return key_hash_int(h, (int64_t)value);
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	h = key_hash_mix(h, KEY_HASH_TAG_DOUBLE);
+	return key_hash_mix(h, bits);
+}
+
+/**
+ * Hash a decimal given as MP_EXT payload in the same way as an
+ * equal integer or double. Return false, when the payload is
+ * malformed.
+ *
+ * The payload is a scale (MP_INT or MP_UINT) followed by packed
+ * BCD digits with a sign in the last nibble. Trailing zeros are
+ * stripped, so 1, 1.0 and 1.00 have the same hash.
+ */
+static bool
+key_hash_decimal(uint64_t *h, const char *data, uint32_t len)
+{
+	const char *end = data + len;
+	int64_t scale;
+	if (len == 0)
+		return false;
+	if (mp_typeof(*data) == MP_UINT) {
+		uint64_t u = mp_decode_uint(&data);
+		if (u > INT32_MAX)
+			return false;
+		scale = (int64_t)u;
+	} else if (mp_typeof(*data) == MP_INT) {
+		scale = mp_decode_int(&data);
+		if (scale < INT32_MIN)
+			return false;
+	} else {
+		return false;
+	}
+	if (data >= end)
+		return false;
+
+	char digits[KEY_HASH_DECIMAL_DIGITS_MAX];
+	uint32_t digit_count = 0;
+	uint32_t nibble_count = 2 * (end - data);
+	uint8_t sign = 0;
+	for (uint32_t i = 0; i < nibble_count; ++i) {
+		uint8_t byte = data[i / 2];
+		uint8_t nibble = i % 2 == 0 ? byte >> 4 : byte & 0x0f;
+		if (i == nibble_count - 1) {
+			sign = nibble;
+			break;
+		}
+		if (nibble > 9)
+			return false;
+		/* Skip leading zeros. */
+		if (digit_count == 0 && nibble == 0)
+			continue;
+		if (digit_count == KEY_HASH_DECIMAL_DIGITS_MAX)
+			return false;
+		digits[digit_count++] = nibble;
+	}
+	if (sign < 0x0a)
+		return false;
+	bool is_negative = sign == 0x0b || sign == 0x0d;
+
+	/* Strip trailing zeros. */
+	while (digit_count > 0 && digits[digit_count - 1] == 0) {
+		--digit_count;
+		--scale;
+	}
+	if (digit_count == 0) {
+		*h = key_hash_int(*h, 0);
+		return true;
+	}
+
+	/* An integral value is hashed as an integer. */
+	if (scale <= 0 && digit_count - scale <= 20) {
+		uint64_t value = 0;
+		bool overflow = false;
+		for (int64_t i = 0; i < digit_count - scale && !overflow;
+		     ++i) {
+			uint64_t digit = i < digit_count ? digits[i] : 0;
+			overflow = value > (UINT64_MAX - digit) / 10;
+			value = value * 10 + digit;
+		}
+		if (!overflow && !is_negative) {
+			*h = key_hash_mix(*h, KEY_HASH_TAG_UINT);
+			*h = key_hash_mix(*h, value);
+			return true;
+		}
+		if (!overflow && value <= (uint64_t)INT64_MAX + 1) {
+			*h = key_hash_int(*h, value == (uint64_t)INT64_MAX + 1 ?
+					  INT64_MIN : -(int64_t)value);
+			return true;
+		}
+	}
+
+	/* A value, which may be equal to a double. */
+	if (digit_count <= KEY_HASH_DECIMAL_DBL_DIG) {
+		char buf[KEY_HASH_DECIMAL_DBL_DIG + 32];
+		char *p = buf;
+		if (is_negative)
+			*p++ = '-';
+		for (uint32_t i = 0; i < digit_count; ++i)
+			*p++ = '0' + digits[i];
+		snprintf(p, buf + sizeof(buf) - p, "e%lld",
+			 (long long)-scale);
+		*h = key_hash_double(*h, strtod(buf, NULL));
+		return true;
+	}
+
+	*h = key_hash_mix(*h, KEY_HASH_TAG_DECIMAL);
+	*h = key_hash_mix(*h, is_negative);
+	*h = key_hash_mix(*h, (uint64_t)scale);
+	*h = key_hash_bytes(*h, digits, digit_count);
+	return true;
+}
+
+uint64_t
+key_hash_field(uint64_t h, const char **field)
+{
+	const char *data;
+	uint32_t len;
+	switch (mp_typeof(**field)) {
+	case MP_NIL:
+		mp_decode_nil(field);
+		return key_hash_mix(h, KEY_HASH_TAG_NIL);
+	case MP_BOOL:
+		h = key_hash_mix(h, KEY_HASH_TAG_BOOL);
+		return key_hash_mix(h, mp_decode_bool(field));
+	case MP_UINT:
+		h = key_hash_mix(h, KEY_HASH_TAG_UINT);
+		return key_hash_mix(h, mp_decode_uint(field));
+	case MP_INT:
+		return key_hash_int(h, mp_decode_int(field));
+	case MP_FLOAT:
+		return key_hash_double(h, mp_decode_float(field));
+	case MP_DOUBLE:
+		return key_hash_double(h, mp_decode_double(field));
+	case MP_STR:
+		data = mp_decode_str(field, &len);
+		h = key_hash_mix(h, KEY_HASH_TAG_STR);
+		return key_hash_bytes(h, data, len);
+	case MP_BIN:
+		data = mp_decode_bin(field, &len);
+		h = key_hash_mix(h, KEY_HASH_TAG_BIN);
+		return key_hash_bytes(h, data, len);
+	case MP_EXT: {
+		int8_t type;
+		data = mp_decode_ext(field, &type, &len);
+		if (type == MP_EXT_DECIMAL && key_hash_decimal(&h, data, len))
+			return h;
+		h = key_hash_mix(h, KEY_HASH_TAG_EXT);
+		h = key_hash_mix(h, (uint8_t)type);
+		return key_hash_bytes(h, data, len);
+	}
+	default:
+		/* Arrays and maps are not key fields. */
+		data = *field;
+		mp_next(field);
+		h = key_hash_mix(h, KEY_HASH_TAG_RAW);
+		return key_hash_bytes(h, data, *field - data);
+	}
+}
+
+uint64_t
+key_hash_finish(uint64_t h, uint32_t part_count)
+{
+	return key_hash_fmix(h ^ part_count);
+}
+
+uint64_t
+key_hash_mp(const char *key)
+{
+	uint32_t part_count = mp_decode_array(&key);
+	uint64_t h = KEY_HASH_SEED;
+	for (uint32_t i = 0; i < part_count; ++i)
+		h = key_hash_field(h, &key);
+	return key_hash_finish(h, part_count);
+}
+
+uint64_t
+key_hash_tuple(const char *tuple, const uint32_t *fieldnos,
+	       uint32_t part_count, const char **fields,
+	       uint32_t field_count)
+{
+	static const char mp_nil = '\xc0';
+
+	uint32_t tuple_field_count = mp_decode_array(&tuple);
+	uint32_t i = 0;
+	for (; i < field_count && i < tuple_field_count; ++i) {
+		fields[i] = tuple;
+		mp_next(&tuple);
+	}
+	for (; i < field_count; ++i)
+		fields[i] = &mp_nil;
+
+	uint64_t h = KEY_HASH_SEED;
+	for (uint32_t part = 0; part < part_count; ++part) {
+		const char *field = fields[fieldnos[part]];
+		h = key_hash_field(h, &field);
+	}
+	return key_hash_finish(h, part_count);
+}
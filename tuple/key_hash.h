@@ -0,0 +1,109 @@
+#ifndef TUPLE_KEYDEF_KEY_HASH_H_INCLUDED
+#define TUPLE_KEYDEF_KEY_HASH_H_INCLUDED
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* defined(__cplusplus) */
+
+/**
+ * Hashing of key fields.
+ *
+ * The hash is calculated from decoded values rather than from
+ * raw msgpack, so values, which are equal from a key_def point
+ * of view, have the same hash: say, 1, 1.0 and an integer 1
+ * encoded as MP_INT or a decimal 1.00. The exception is strings
+ * with a collation: they are hashed by their bytes.
+ *
+ * The hash does not depend on a platform: it may be calculated
+ * on one instance and verified on another.
+ */
+
+/** Initial value for key_hash_field(). */
+enum { KEY_HASH_SEED = 13 };
+
+/**
+ * Mix a msgpack field into a hash and advance @a field to the
+ * next one.
+ */
+uint64_t
+key_hash_field(uint64_t hash, const char **field);
+
+/**
+ * Finalize a hash of @a part_count fields.
+ */
+uint64_t
+key_hash_finish(uint64_t hash, uint32_t part_count);
+
+/**
+ * Hash a key: a msgpack array of key fields.
+ */
+uint64_t
+key_hash_mp(const char *key);
+
+/**
+ * Hash key fields of a raw tuple (a msgpack array), which are
+ * given by zero based field numbers. A missing field is hashed
+ * as nil.
+ *
+ * @a fields is a scratch array of @a field_count items, which
+ * must be greater than any of @a fieldnos.
+ *
+ * The result is the same as key_hash_mp() of the extracted key.
+ */
+uint64_t
+key_hash_tuple(const char *tuple, const uint32_t *fieldnos,
+	       uint32_t part_count, const char **fields,
+	       uint32_t field_count);
+
+/**
+ * 64 bit finalizer of MurmurHash3: it makes all bits of the
+ * result depend on all bits of the input.
+ */
+static inline uint64_t
+key_hash_fmix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+#if defined(__cplusplus)
+} /* extern "C" */
+#endif /* defined(__cplusplus) */
+
+#endif /* TUPLE_KEYDEF_KEY_HASH_H_INCLUDED */
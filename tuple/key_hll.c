@@ -0,0 +1,114 @@
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY <COPYRIGHT HOLDER> ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * <COPYRIGHT HOLDER> OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "key_hll.h"
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+int
+key_hll_create(struct key_hll *hll, uint32_t precision)
+{
+	assert(precision >= KEY_HLL_PRECISION_MIN &&
+	       precision <= KEY_HLL_PRECISION_MAX);
+	hll->precision = precision;
+	hll->registers = calloc(key_hll_register_count(hll), 1);
+	return hll->registers == NULL ? -1 : 0;
+}
+
+void
+key_hll_destroy(struct key_hll *hll)
+{
+	free(hll->registers);
+	hll->registers = NULL;
+}
+
+void
+key_hll_add(struct key_hll *hll, uint64_t hash)
+{
+	uint32_t idx = hash >> (64 - hll->precision);
+	/*
+	 * The rank is the position of the first set bit in the
+	 * rest of the hash. The guard bit limits it when the rest
+	 * is zero.
+	 */
+	uint64_t rest = (hash << hll->precision) |
+			((uint64_t)1 << (hll->precision - 1));
+	uint8_t rank = __builtin_clzll(rest) + 1;
+	if (hll->registers[idx] < rank)
+		hll->registers[idx] = rank;
+}
+
+void
+key_hll_merge(struct key_hll *dst, const struct key_hll *src)
+{
+	assert(dst->precision == src->precision);
+	uint32_t count = key_hll_register_count(dst);
+	for (uint32_t i = 0; i < count; ++i) {
+		if (dst->registers[i] < src->registers[i])
+			dst->registers[i] = src->registers[i];
+	}
+}
+
+/** Bias correction constant of the raw estimation. */
+static double
+key_hll_alpha(uint32_t m)
+{
+	switch (m) {
+	case 16:
+		return 0.673;
+	case 32:
+		return 0.697;
+	case 64:
+		return 0.709;
+	default:
+		return 0.7213 / (1 + 1.079 / m);
+	}
+}
+
+double
+key_hll_estimate(const struct key_hll *hll)
+{
+	uint32_t m = key_hll_register_count(hll);
+	double sum = 0;
+	uint32_t zero_count = 0;
+	for (uint32_t i = 0; i < m; ++i) {
+		sum += ldexp(1, -hll->registers[i]);
+		if (hll->registers[i] == 0)
+			++zero_count;
+	}
+	double estimate = key_hll_alpha(m) * m * m / sum;
+	/* Use linear counting for small cardinalities. */
+	if (estimate <= 2.5 * m && zero_count > 0)
+		estimate = m * log((double)m / zero_count);
+	return estimate;
+}
@@ -0,0 +1,98 @@
+#ifndef TUPLE_KEYDEF_KEY_HLL_H_INCLUDED
+#define TUPLE_KEYDEF_KEY_HLL_H_INCLUDED
+/*
+ * Copyright 2010-2020, Tarantool AUTHORS, please see AUTHORS file.
+ *
+ * Redistribution and use in source and binary forms, with or
+ * without modification, are permitted provided that the following
+ * conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above
+ *    copyright notice, this list of conditions and the
+ *    following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials
+ *    provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* defined(__cplusplus) */
+
+/**
+ * HyperLogLog sketch over key hashes (see key_hash.h): an
+ * estimation of the number of distinct keys in fixed memory.
+ *
+ * The sketch has 2^precision one byte registers. The standard
+ * error of the estimation is about 1.04 / sqrt(2^precision).
+ *
+ * Hashes are 64 bit, so no large range correction is needed.
+ */
+
+enum {
+	KEY_HLL_PRECISION_MIN = 4,
+	KEY_HLL_PRECISION_MAX = 18,
+};
+
+struct key_hll {
+	/** Number of bits of a hash, which select a register. */
+	uint32_t precision;
+	/** 2^precision registers. */
+	uint8_t *registers;
+};
+
+/** Number of registers of a sketch. */
+static inline uint32_t
+key_hll_register_count(const struct key_hll *hll)
+{
+	return (uint32_t)1 << hll->precision;
+}
+
+/**
+ * Allocate an empty sketch.
+ *
+ * Return 0 on success, -1 on memory allocation error.
+ */
+int
+key_hll_create(struct key_hll *hll, uint32_t precision);
+
+void
+key_hll_destroy(struct key_hll *hll);
+
+void
+key_hll_add(struct key_hll *hll, uint64_t hash);
+
+/**
+ * Add all keys of @a src to @a dst. The sketches must have the
+ * same precision.
+ */
+void
+key_hll_merge(struct key_hll *dst, const struct key_hll *src);
+
+/** Estimate the number of distinct added keys. */
+double
+key_hll_estimate(const struct key_hll *hll);
+
+#if defined(__cplusplus)
+} /* extern "C" */
+#endif /* defined(__cplusplus) */
+
+#endif /* TUPLE_KEYDEF_KEY_HLL_H_INCLUDED */
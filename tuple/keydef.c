@@ -30,12 +30,21 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <math.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <lua.h>
 #include <lauxlib.h>
 #include <tarantool/module.h>
+#include <msgpuck.h>
 #include "util.h"
+#include "key_hash.h"
+#include "key_block.h"
+#include "key_bloom.h"
+#include "key_hll.h"
 #include "keydef_version.h"
 
 /*
@@ -52,6 +61,12 @@ static_assert(sizeof(box_key_part_def_t) == BOX_KEY_PART_DEF_T_SIZE,
 enum { TUPLE_INDEX_BASE = 1 };
 
 static uint32_t CTID_STRUCT_TUPLE_KEY_DEF_REF = 0;
+static uint32_t CTID_STRUCT_TUPLE_KEYDEF_BLOOM_REF = 0;
+static uint32_t CTID_STRUCT_TUPLE_KEYDEF_HLL_REF = 0;
+static uint32_t CTID_STRUCT_TUPLE_KEYDEF_KEY_BLOCK_REF = 0;
+static uint32_t CTID_STRUCT_TUPLE_KEYDEF_MULTIKEY_REF = 0;
+static uint32_t CTID_STRUCT_IBUF = 0;
+static uint32_t CTID_STRUCT_IBUF_REF = 0;
 static bool JSON_PATH_IS_SUPPORTED = false;
 
 /*
@@ -147,12 +162,11 @@ field_type_is_supported(const char *field_type, size_t len)
  * The function may be used on an invalid JSON path and may
  * report such path either as 'multikey path' or the opposite.
  *
- * FIXME: Future implementation should support 'multikey path'
- * key_defs, so it would not be worthful to expose relevant
- * functions from tarantool (and take care of backward
- * compatibility). Tarantool side limitations around such key_defs
- * should be reflected in the module API: whether it is possible
- * to do <...> using particular key_def.
+ * FIXME: Tarantool side limitations around 'multikey path'
+ * key_defs should be reflected in the module API: whether it is
+ * possible to do <...> using particular key_def. Now the module
+ * creates a separate object for such key_def, see
+ * <struct tuple_keydef_multikey>.
  */
 static bool
 json_path_is_multikey(const char *path)
@@ -210,12 +224,462 @@ json_path_is_supported(bool *res)
 		      ##__VA_ARGS__);					\
 } while (0)
 
+#define DIAG_SET_ER_PROC_C(...) do {				\
+	box_error_set(__FILE__, __LINE__, ER_PROC_C, ##__VA_ARGS__);	\
+} while (0)
+
 #define diag_set(box_error_code, ...) do {	\
 	DIAG_SET_##box_error_code(__VA_ARGS__);	\
 } while(0)
 
+/**
+ * Names of box iterator types in the order of
+ * <enum iterator_type> values.
+ *
+ * Types behind ITER_GT are not listed: they have no meaning for
+ * a key range.
+ */
+static const char *const iterator_type_strs[] = {
+	"EQ",
+	"REQ",
+	"ALL",
+	"LT",
+	"LE",
+	"GE",
+	"GT",
+};
+
+/**
+ * Get an iterator type from the given field of an options table
+ * at @a idx.
+ *
+ * The type may be given by its name (say, 'GE') or by its
+ * number (say, box.index.GE). @a dflt is used, when the field
+ * is nil.
+ *
+ * Return 0 on success, otherwise return -1 and set a diag.
+ */
+static int
+luaT_opts_iterator_type(struct lua_State *L, int idx, const char *field,
+			enum iterator_type dflt, enum iterator_type *res)
+{
+	*res = dflt;
+	if (lua_isnil(L, idx))
+		return 0;
+
+	int max = lengthof(iterator_type_strs);
+	lua_getfield(L, idx, field);
+	if (lua_isnil(L, -1)) {
+		/* Use the default. */
+	} else if (lua_type(L, -1) == LUA_TNUMBER) {
+		lua_Integer type = lua_tointeger(L, -1);
+		*res = type >= 0 && type < max ? type : iterator_type_MAX;
+	} else if (lua_type(L, -1) == LUA_TSTRING) {
+		size_t len;
+		const char *name = lua_tolstring(L, -1, &len);
+		int type = strnindex(iterator_type_strs, name, len, max);
+		*res = type < max ? type : iterator_type_MAX;
+	} else {
+		*res = iterator_type_MAX;
+	}
+	lua_pop(L, 1);
+
+	if (*res == iterator_type_MAX) {
+		diag_set(ER_ILLEGAL_PARAMS, "Unknown iterator type in %s",
+			 field);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Get a boolean value from the given field of an options table
+ * at @a idx. Return false for an absent table or field.
+ */
+static bool
+luaT_opts_bool(struct lua_State *L, int idx, const char *field)
+{
+	if (lua_isnil(L, idx))
+		return false;
+	lua_getfield(L, idx, field);
+	bool res = lua_toboolean(L, -1) != 0;
+	lua_pop(L, 1);
+	return res;
+}
+
+/**
+ * Get a number from the given field of an options table at
+ * @a idx. @a dflt is used, when the table or the field is nil.
+ *
+ * Return 0 on success, otherwise return -1 and set a diag.
+ */
+static int
+luaT_opts_number(struct lua_State *L, int idx, const char *field,
+		 double dflt, double *res)
+{
+	*res = dflt;
+	if (lua_isnil(L, idx))
+		return 0;
+	lua_getfield(L, idx, field);
+	int rc = 0;
+	if (lua_type(L, -1) == LUA_TNUMBER) {
+		*res = lua_tonumber(L, -1);
+	} else if (! lua_isnil(L, -1)) {
+		diag_set(ER_ILLEGAL_PARAMS, "%s must be a number", field);
+		rc = -1;
+	}
+	lua_pop(L, 1);
+	return rc;
+}
+
+/**
+ * Create a copy of a key definition.
+ *
+ * It is necessary for an object, which outlives the Lua
+ * reference to the key definition it is built from.
+ */
+static box_key_def_t *
+key_def_dup(const box_key_def_t *key_def)
+{
+	size_t region_svp = box_region_used();
+	uint32_t part_count = 0;
+	box_key_part_def_t *parts = box_key_def_dump_parts(key_def,
+							   &part_count);
+	if (parts == NULL) {
+		box_region_truncate(region_svp);
+		return NULL;
+	}
+	box_key_def_t *res = box_key_def_new_v2(parts, part_count);
+	box_region_truncate(region_svp);
+	return res;
+}
+
+/**
+ * Whether a key definition has a part with a collation.
+ *
+ * Return 0 on success and set *res to true/false. Otherwise
+ * return -1 and set a diag.
+ */
+static int
+key_def_has_collation(const box_key_def_t *key_def, bool *res)
+{
+	*res = false;
+	size_t region_svp = box_region_used();
+	uint32_t part_count = 0;
+	box_key_part_def_t *parts = box_key_def_dump_parts(key_def,
+							   &part_count);
+	if (parts == NULL) {
+		box_region_truncate(region_svp);
+		return -1;
+	}
+	for (uint32_t i = 0; i < part_count; ++i) {
+		if (parts[i].collation != NULL) {
+			*res = true;
+			break;
+		}
+	}
+	box_region_truncate(region_svp);
+	return 0;
+}
+
+/**
+ * Verify that equal keys have equal hashes (see key_hash.h):
+ * that is, there are no key parts with a collation.
+ *
+ * Return 0 on success, otherwise return -1 and set a diag.
+ */
+static int
+key_def_check_hashable(const box_key_def_t *key_def)
+{
+	bool has_collation;
+	if (key_def_has_collation(key_def, &has_collation) != 0)
+		return -1;
+	if (has_collation) {
+		diag_set(ER_ILLEGAL_PARAMS, "Hashing of a key part with a "
+			 "collation is not supported");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Create a key definition, which compares keys extracted using
+ * @a key_def: part i points to field i.
+ *
+ * Return NULL and set a diag at a failure.
+ */
+static box_key_def_t *
+key_def_new_for_keys(const box_key_def_t *key_def)
+{
+	size_t region_svp = box_region_used();
+	uint32_t part_count = 0;
+	box_key_part_def_t *parts = box_key_def_dump_parts(key_def,
+							   &part_count);
+	if (parts == NULL) {
+		box_region_truncate(region_svp);
+		return NULL;
+	}
+	for (uint32_t i = 0; i < part_count; ++i) {
+		parts[i].fieldno = i;
+		if (JSON_PATH_IS_SUPPORTED)
+			JSON_PATH_SET(&parts[i], NULL);
+	}
+	box_key_def_t *res = box_key_def_new_v2(parts, part_count);
+	box_region_truncate(region_svp);
+	return res;
+}
+
+/**
+ * A searched key for key_search_cmp().
+ *
+ * The key is compared with keys, which are extracted by a key
+ * definition. The comparison is done by a key definition from
+ * key_def_new_for_keys(): the searched key is made a tuple.
+ */
+struct key_search {
+	/** The key as a tuple. */
+	box_tuple_t *key;
+	uint32_t part_count;
+	box_key_def_t *cmp_def;
+	/** Buffer for a prefix of a stored key. */
+	char *buf;
+};
+
+/**
+ * Compare a stored key with a searched one. Return a negative
+ * value, when the stored key is less.
+ *
+ * The searched key may be partial.
+ */
+static int
+key_search_cmp(const char *key, uint32_t key_size, void *arg)
+{
+	(void)key_size;
+	struct key_search *search = arg;
+	const char *fields = key;
+	uint32_t part_count = mp_decode_array(&fields);
+	if (search->part_count < part_count) {
+		/*
+		 * The searched key is a tuple, which has no more
+		 * fields than the key parts. Cut the stored key to
+		 * don't compare absent fields.
+		 */
+		const char *end = fields;
+		for (uint32_t i = 0; i < search->part_count; ++i)
+			mp_next(&end);
+		char *p = mp_encode_array(search->buf, search->part_count);
+		memcpy(p, fields, end - fields);
+		key = search->buf;
+	}
+	return -box_tuple_compare_with_key(search->key, key,
+					   search->cmp_def);
+}
+
 /* }}} Helpers */
 
+/* {{{ Tuple sources */
+
+/**
+ * Kinds of a batch operation input, see <struct tuple_source>.
+ */
+enum tuple_source_type {
+	/** An array-like Lua table. */
+	TUPLE_SOURCE_TABLE,
+	/** A function, which returns next value or nil. */
+	TUPLE_SOURCE_FUNCTION,
+	/**
+	 * A luafun iterator object: say, the result of
+	 * box.space.<...>:pairs().
+	 */
+	TUPLE_SOURCE_ITERATOR,
+};
+
+/**
+ * Input of a batch operation.
+ *
+ * The source does not hold tuples itself: each value is pushed
+ * to the Lua stack and stays anchored there until the caller
+ * pops it.
+ */
+struct tuple_source {
+	enum tuple_source_type type;
+	/** Lua stack index of the table or the function. */
+	int idx;
+	/**
+	 * Lua stack index of the iterator's gen function. Its
+	 * param and state are stored right after it.
+	 */
+	int gen_idx;
+	/** Length of the table. */
+	uint32_t size;
+	/** How many values are produced so far. */
+	uint32_t count;
+	/** Yield after this number of values, 0 is never. */
+	uint32_t yield_every;
+	/**
+	 * Yield after this number of seconds of continuous work,
+	 * 0 is never.
+	 */
+	double yield_interval;
+	/** fiber_clock() at the start or at the last yield. */
+	double yield_time;
+};
+
+/**
+ * Check the time to yield after each this number of values to
+ * don't call fiber_clock() too often.
+ */
+enum { TUPLE_SOURCE_CLOCK_CHECK_PERIOD = 64 };
+
+/**
+ * Initialize a tuple source from a Lua value at @a idx.
+ *
+ * Gen, param and state of a luafun iterator are pushed to the
+ * Lua stack. They must stay there while the source is in use.
+ *
+ * The source yields the fiber according to the following fields
+ * of an options table at @a opts_idx (it may be nil):
+ *
+ * - yield_every: yield after each this number of values;
+ * - yield_interval: yield after each this number of seconds of
+ *   continuous work.
+ *
+ * The yield occurs before producing next value, so a caller
+ * must keep tuples it holds referenced and encoded keys
+ * anchored on the Lua stack (see luaT_key_def_push_key()).
+ *
+ * Return 0 on success, otherwise return -1 and set a diag.
+ */
+static int
+luaT_tuple_source_create(struct lua_State *L, int idx, int opts_idx,
+			 struct tuple_source *source)
+{
+	if (idx < 0)
+		idx = lua_gettop(L) + idx + 1;
+	source->idx = idx;
+	source->gen_idx = 0;
+	source->size = 0;
+	source->count = 0;
+
+	double yield_every;
+	if (luaT_opts_number(L, opts_idx, "yield_every", 0,
+			     &yield_every) != 0 ||
+	    luaT_opts_number(L, opts_idx, "yield_interval", 0,
+			     &source->yield_interval) != 0)
+		return -1;
+	if (! (yield_every >= 0 && yield_every <= UINT32_MAX) ||
+	    yield_every != floor(yield_every)) {
+		diag_set(ER_ILLEGAL_PARAMS, "yield_every must be a "
+			 "non-negative integer");
+		return -1;
+	}
+	if (! (source->yield_interval >= 0)) {
+		diag_set(ER_ILLEGAL_PARAMS, "yield_interval must be "
+			 "non-negative");
+		return -1;
+	}
+	source->yield_every = (uint32_t)yield_every;
+	source->yield_time = source->yield_interval > 0 ? fiber_clock() : 0;
+
+	if (lua_isfunction(L, idx)) {
+		source->type = TUPLE_SOURCE_FUNCTION;
+		return 0;
+	}
+	if (! lua_istable(L, idx)) {
+		diag_set(ER_ILLEGAL_PARAMS, "Expected an array of tuples "
+			 "or an iterator");
+		return -1;
+	}
+
+	lua_getfield(L, idx, "gen");
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		source->type = TUPLE_SOURCE_TABLE;
+		source->size = lua_objlen(L, idx);
+		return 0;
+	}
+	source->type = TUPLE_SOURCE_ITERATOR;
+	source->gen_idx = lua_gettop(L);
+	lua_getfield(L, idx, "param");
+	lua_getfield(L, idx, "state");
+	return 0;
+}
+
+/**
+ * Yield the fiber if it works too long according to the source
+ * options.
+ */
+static void
+tuple_source_maybe_yield(struct tuple_source *source)
+{
+	uint32_t count = source->count;
+	if (count == 0)
+		return;
+	bool yield = false;
+	if (source->yield_every != 0 && count % source->yield_every == 0)
+		yield = true;
+	else if (source->yield_interval > 0 &&
+		 count % TUPLE_SOURCE_CLOCK_CHECK_PERIOD == 0 &&
+		 fiber_clock() - source->yield_time >= source->yield_interval)
+		yield = true;
+	if (! yield)
+		return;
+	fiber_sleep(0);
+	if (source->yield_interval > 0)
+		source->yield_time = fiber_clock();
+}
+
+/**
+ * Push next value of a tuple source to the Lua stack.
+ *
+ * Return false, when the source is exhausted. Nothing is pushed
+ * in the case.
+ *
+ * The fiber may yield here, see luaT_tuple_source_create().
+ *
+ * An error raised by an iterator is propagated as is.
+ */
+static bool
+luaT_tuple_source_next(struct lua_State *L, struct tuple_source *source)
+{
+	tuple_source_maybe_yield(source);
+
+	switch (source->type) {
+	case TUPLE_SOURCE_TABLE:
+		if (source->count >= source->size)
+			return false;
+		lua_rawgeti(L, source->idx, source->count + 1);
+		break;
+	case TUPLE_SOURCE_FUNCTION:
+		lua_pushvalue(L, source->idx);
+		lua_call(L, 0, 1);
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			return false;
+		}
+		break;
+	case TUPLE_SOURCE_ITERATOR:
+		lua_pushvalue(L, source->gen_idx);
+		lua_pushvalue(L, source->gen_idx + 1);
+		lua_pushvalue(L, source->gen_idx + 2);
+		lua_call(L, 2, 2);
+		if (lua_isnil(L, -2)) {
+			lua_pop(L, 2);
+			return false;
+		}
+		/* Save the new state, leave the value on the top. */
+		lua_insert(L, -2);
+		lua_replace(L, source->gen_idx + 2);
+		break;
+	default:
+		assert(false);
+	}
+	++source->count;
+	return true;
+}
+
+/* }}} Tuple sources */
+
 static void
 luaT_key_def_to_table(struct lua_State *L, const box_key_def_t *key_def)
 {
@@ -362,15 +826,10 @@ luaT_key_def_set_part(struct lua_State *L, box_key_part_def_t *part)
 
 		/*
 		 * JSON path will be validated in
-		 * box_key_def_new_v2().
+		 * box_key_def_new_v2(). A multikey path is
+		 * accepted, see lbox_key_def_new().
 		 */
 
-		if (json_path_is_multikey(path)) {
-			diag_set(ER_ILLEGAL_PARAMS,
-				 "Multikey JSON path is not supported");
-			return -1;
-		}
-
 		/*
 		 * FIXME: Revisit this part and think whether we
 		 * actually need to copy JSON paths.
@@ -411,72 +870,312 @@ luaT_key_def_check_tuple(struct lua_State *L, box_key_def_t *key_def, int idx)
 	return tuple;
 }
 
-static box_key_def_t *
-luaT_check_key_def(struct lua_State *L, int idx)
+/**
+ * Get next value of a tuple source as a tuple checked by
+ * @a key_def and store it at @a slot of the Lua stack, which
+ * anchors it across yields and errors.
+ *
+ * A tuple cdata is stored as is, only a Lua table is wrapped
+ * into a new tuple.
+ *
+ * Return 1 on success, 0 when the source is exhausted. Otherwise
+ * return -1 and set a diag.
+ */
+static int
+luaT_tuple_source_next_tuple(struct lua_State *L,
+			     struct tuple_source *source,
+			     box_key_def_t *key_def, int slot,
+			     box_tuple_t **tuple)
 {
-	if (! luaL_iscdata(L, idx))
-		return NULL;
-
-	uint32_t cdata_type;
-	box_key_def_t **key_def_ptr = luaL_checkcdata(L, idx, &cdata_type);
-	if (key_def_ptr == NULL || cdata_type != CTID_STRUCT_TUPLE_KEY_DEF_REF)
-		return NULL;
-	return *key_def_ptr;
+	if (! luaT_tuple_source_next(L, source))
+		return 0;
+	int idx = lua_gettop(L);
+	box_tuple_t *t = luaT_istuple(L, idx);
+	if (t == NULL) {
+		t = luaT_tuple_new(L, idx, box_tuple_format_default());
+		if (t == NULL)
+			return -1;
+		lua_pop(L, 1);
+		luaT_pushtuple(L, t);
+	}
+	lua_replace(L, slot);
+	if (box_key_def_validate_tuple(key_def, t) != 0)
+		return -1;
+	*tuple = t;
+	return 1;
 }
 
 /**
- * Free a key_def from a Lua code.
+ * Get next tuple of a sorted input @a name (see
+ * luaT_tuple_source_next_tuple()) and verify that its key is
+ * not less than the key of the current tuple *@a tuple. When
+ * @a is_unique is set, equal keys are not allowed too.
+ *
+ * The current tuple is moved from @a slot to @a prev_slot to
+ * keep it referenced till the comparison.
+ *
+ * Return 1 on success, 0 when the source is exhausted. Otherwise
+ * return -1 and set a diag.
  */
 static int
-lbox_key_def_gc(struct lua_State *L)
+luaT_tuple_source_next_sorted(struct lua_State *L,
+			      struct tuple_source *source,
+			      box_key_def_t *key_def, int slot,
+			      int prev_slot, const char *name,
+			      bool is_unique, box_tuple_t **tuple)
 {
-	box_key_def_t *key_def = luaT_check_key_def(L, 1);
-	assert(key_def != NULL);
-	box_key_def_delete(key_def);
-	return 0;
+	box_tuple_t *prev = *tuple;
+	lua_pushvalue(L, slot);
+	lua_replace(L, prev_slot);
+	int rc = luaT_tuple_source_next_tuple(L, source, key_def, slot,
+					      tuple);
+	if (rc <= 0 || prev == NULL)
+		return rc;
+	int cmp = box_tuple_compare(prev, *tuple, key_def);
+	if (cmp > 0 || (cmp == 0 && is_unique)) {
+		diag_set(ER_ILLEGAL_PARAMS, "Tuples are not sorted: see "
+			 "tuple %u of %s", (unsigned)source->count, name);
+		return -1;
+	}
+	return rc;
 }
 
 /**
- * Extract key from tuple by given key definition and return
- * tuple representing this key.
- * Push the new key tuple as cdata to a Lua stack on success.
- * Raise error otherwise.
+ * Encode a key from a Lua table or a tuple at @a idx, validate it
+ * using the key definition and push it to the Lua stack as a
+ * string.
+ *
+ * The string anchors the encoded key: it remains valid after the
+ * box region is truncated or the fiber yields.
+ *
+ * Return the key on success, otherwise return NULL and set a
+ * diag.
  */
-static int
-lbox_key_def_extract_key(struct lua_State *L)
+static const char *
+luaT_key_def_push_key(struct lua_State *L, box_key_def_t *key_def, int idx)
 {
-	box_key_def_t *key_def;
-	if (lua_gettop(L) != 2 || (key_def = luaT_check_key_def(L, 1)) == NULL)
-		return luaL_error(L, "Usage: key_def:extract_key(tuple)");
-
-	struct tuple *tuple;
-	if ((tuple = luaT_key_def_check_tuple(L, key_def, 2)) == NULL)
-		return luaT_error(L);
-
 	size_t region_svp = box_region_used();
-	uint32_t key_size;
-	char *key = box_key_def_extract_key(key_def, tuple,
-					    KEY_DEF_MULTIKEY_NONE, &key_size);
-	box_tuple_unref(tuple);
-	if (key == NULL)
-		return luaT_error(L);
-
-	struct tuple *ret =
-		box_tuple_new(box_tuple_format_default(), key, key + key_size);
+	size_t key_size;
+	const char *key = luaT_tuple_encode(L, idx, &key_size);
+	if (key == NULL || box_key_def_validate_key(key_def, key, NULL) != 0) {
+		box_region_truncate(region_svp);
+		return NULL;
+	}
+	lua_pushlstring(L, key, key_size);
 	box_region_truncate(region_svp);
-	if (ret == NULL)
-		return luaT_error(L);
-	luaT_pushtuple(L, ret);
-	return 1;
+	return lua_tostring(L, -1);
 }
 
 /**
- * Compare tuples using the key definition.
- * Push 0  if key_fields(tuple_a) == key_fields(tuple_b)
- *      <0 if key_fields(tuple_a) < key_fields(tuple_b)
- *      >0 if key_fields(tuple_a) > key_fields(tuple_b)
- * integer to a Lua stack on success.
- * Raise error otherwise.
+ * Encode a (partial) key at @a idx of the Lua stack, validate it
+ * using @a key_def and prepare a search of it, see
+ * <struct key_search>.
+ *
+ * The key tuple is referenced till key_search_destroy(). The
+ * buffer for stored keys is left for a caller to set.
+ *
+ * Return 0 on success, otherwise return -1 and set a diag.
+ */
+static int
+luaT_key_search_create(struct lua_State *L, int idx, box_key_def_t *key_def,
+		       box_key_def_t *cmp_def, struct key_search *search)
+{
+	size_t region_svp = box_region_used();
+	size_t key_size;
+	const char *key = luaT_tuple_encode(L, idx, &key_size);
+	if (key == NULL ||
+	    box_key_def_validate_key(key_def, key, NULL) != 0) {
+		box_region_truncate(region_svp);
+		return -1;
+	}
+	const char *fields = key;
+	search->part_count = mp_decode_array(&fields);
+	search->cmp_def = cmp_def;
+	search->buf = NULL;
+	search->key = box_tuple_new(box_tuple_format_default(), key,
+				    key + key_size);
+	box_region_truncate(region_svp);
+	if (search->key == NULL)
+		return -1;
+	box_tuple_ref(search->key);
+	return 0;
+}
+
+static void
+key_search_destroy(struct key_search *search)
+{
+	box_tuple_unref(search->key);
+}
+
+/**
+ * Hash a key of a tuple or a Lua table at @a idx, see
+ * key_hash.h.
+ *
+ * Return 0 on success, otherwise return -1 and set a diag.
+ */
+static int
+luaT_key_def_hash_tuple(struct lua_State *L, box_key_def_t *key_def, int idx,
+			uint64_t *hash)
+{
+	struct tuple *tuple = luaT_key_def_check_tuple(L, key_def, idx);
+	if (tuple == NULL)
+		return -1;
+	size_t region_svp = box_region_used();
+	uint32_t key_size;
+	const char *key = box_key_def_extract_key(key_def, tuple,
+						  KEY_DEF_MULTIKEY_NONE,
+						  &key_size);
+	box_tuple_unref(tuple);
+	if (key == NULL) {
+		box_region_truncate(region_svp);
+		return -1;
+	}
+	*hash = key_hash_mp(key);
+	box_region_truncate(region_svp);
+	return 0;
+}
+
+static box_key_def_t *
+luaT_check_key_def(struct lua_State *L, int idx)
+{
+	if (! luaL_iscdata(L, idx))
+		return NULL;
+
+	uint32_t cdata_type;
+	box_key_def_t **key_def_ptr = luaL_checkcdata(L, idx, &cdata_type);
+	if (key_def_ptr == NULL || cdata_type != CTID_STRUCT_TUPLE_KEY_DEF_REF)
+		return NULL;
+	return *key_def_ptr;
+}
+
+/**
+ * Get an ibuf from a Lua stack: either <struct ibuf> (say,
+ * buffer.ibuf()) or <struct ibuf *>.
+ */
+static box_ibuf_t *
+luaT_check_ibuf(struct lua_State *L, int idx)
+{
+	if (! luaL_iscdata(L, idx))
+		return NULL;
+
+	uint32_t cdata_type;
+	void *data = luaL_checkcdata(L, idx, &cdata_type);
+	if (data == NULL)
+		return NULL;
+	if (cdata_type == CTID_STRUCT_IBUF)
+		return data;
+	if (cdata_type == CTID_STRUCT_IBUF_REF)
+		return *(box_ibuf_t **)data;
+	return NULL;
+}
+
+/**
+ * Free a key_def from a Lua code.
+ */
+static int
+lbox_key_def_gc(struct lua_State *L)
+{
+	box_key_def_t *key_def = luaT_check_key_def(L, 1);
+	assert(key_def != NULL);
+	box_key_def_delete(key_def);
+	return 0;
+}
+
+/**
+ * Extract key from tuple by given key definition and return
+ * tuple representing this key.
+ * Push the new key tuple as cdata to a Lua stack on success.
+ * Raise error otherwise.
+ */
+static int
+lbox_key_def_extract_key(struct lua_State *L)
+{
+	box_key_def_t *key_def;
+	if (lua_gettop(L) != 2 || (key_def = luaT_check_key_def(L, 1)) == NULL)
+		return luaL_error(L, "Usage: key_def:extract_key(tuple)");
+
+	struct tuple *tuple;
+	if ((tuple = luaT_key_def_check_tuple(L, key_def, 2)) == NULL)
+		return luaT_error(L);
+
+	size_t region_svp = box_region_used();
+	uint32_t key_size;
+	char *key = box_key_def_extract_key(key_def, tuple,
+					    KEY_DEF_MULTIKEY_NONE, &key_size);
+	box_tuple_unref(tuple);
+	if (key == NULL)
+		return luaT_error(L);
+
+	struct tuple *ret =
+		box_tuple_new(box_tuple_format_default(), key, key + key_size);
+	box_region_truncate(region_svp);
+	if (ret == NULL)
+		return luaT_error(L);
+	luaT_pushtuple(L, ret);
+	return 1;
+}
+
+/**
+ * Extract key from tuple by given key definition and append it
+ * to an ibuf as msgpack.
+ *
+ * Unlike key_def:extract_key() no tuple is created for the key,
+ * so it may be used to stream keys to net.box or to a file
+ * without GC pressure.
+ *
+ * Push the key size to a Lua stack on success.
+ * Raise error otherwise.
+ */
+static int
+lbox_key_def_extract_key_into(struct lua_State *L)
+{
+	box_key_def_t *key_def;
+	box_ibuf_t *ibuf;
+	if (lua_gettop(L) != 3 ||
+	    (key_def = luaT_check_key_def(L, 1)) == NULL ||
+	    (ibuf = luaT_check_ibuf(L, 3)) == NULL)
+		return luaL_error(L, "Usage: key_def:extract_key_into(tuple, "
+				  "ibuf)");
+
+	struct tuple *tuple;
+	if ((tuple = luaT_key_def_check_tuple(L, key_def, 2)) == NULL)
+		return luaT_error(L);
+
+	size_t region_svp = box_region_used();
+	uint32_t key_size;
+	char *key = box_key_def_extract_key(key_def, tuple,
+					    KEY_DEF_MULTIKEY_NONE, &key_size);
+	box_tuple_unref(tuple);
+	if (key == NULL) {
+		box_region_truncate(region_svp);
+		return luaT_error(L);
+	}
+
+	char *buf = box_ibuf_reserve(ibuf, key_size);
+	if (buf == NULL) {
+		box_region_truncate(region_svp);
+		diag_set(ER_MEMORY_ISSUE, key_size, "ibuf", "key");
+		return luaT_error(L);
+	}
+	memcpy(buf, key, key_size);
+	box_region_truncate(region_svp);
+
+	char **wpos;
+	char **end;
+	box_ibuf_write_range(ibuf, &wpos, &end);
+	*wpos += key_size;
+
+	lua_pushinteger(L, key_size);
+	return 1;
+}
+
+/**
+ * Compare tuples using the key definition.
+ * Push 0  if key_fields(tuple_a) == key_fields(tuple_b)
+ *      <0 if key_fields(tuple_a) < key_fields(tuple_b)
+ *      >0 if key_fields(tuple_a) > key_fields(tuple_b)
+ * integer to a Lua stack on success.
+ * Raise error otherwise.
  */
 static int
 lbox_key_def_compare(struct lua_State *L)
@@ -546,6 +1245,144 @@ lbox_key_def_compare_with_key(struct lua_State *L)
 	return 1;
 }
 
+/**
+ * Key range bounds.
+ *
+ * A NULL key means that the range is unbounded from the
+ * corresponding side.
+ */
+struct key_range {
+	/** Lower bound: a partial key. */
+	const char *from_key;
+	/** ITER_EQ, ITER_GE or ITER_GT. */
+	enum iterator_type from_type;
+	/** Upper bound: a partial key. */
+	const char *to_key;
+	/** ITER_LE or ITER_LT. */
+	enum iterator_type to_type;
+};
+
+/**
+ * Whether a tuple falls into a key range.
+ */
+static bool
+key_range_contains(const struct key_range *range, box_tuple_t *tuple,
+		   box_key_def_t *key_def)
+{
+	if (range->from_key != NULL) {
+		int rc = box_tuple_compare_with_key(tuple, range->from_key,
+						    key_def);
+		switch (range->from_type) {
+		case ITER_EQ:
+			if (rc != 0)
+				return false;
+			break;
+		case ITER_GT:
+			if (rc <= 0)
+				return false;
+			break;
+		default:
+			if (rc < 0)
+				return false;
+			break;
+		}
+	}
+	if (range->to_key != NULL) {
+		int rc = box_tuple_compare_with_key(tuple, range->to_key,
+						    key_def);
+		if (range->to_type == ITER_LT ? rc >= 0 : rc > 0)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Select tuples, which fall into a key range.
+ *
+ * Bound keys may be partial. Either of them may be nil to leave
+ * the range unbounded from the corresponding side. The keys are
+ * encoded once for the whole batch.
+ *
+ * Options:
+ *
+ * - from: 'GE' (default), 'GT' or 'EQ';
+ * - to: 'LE' (default) or 'LT';
+ * - positions: push positions of matched tuples in the input
+ *   instead of the tuples itself;
+ * - yield_every, yield_interval: see luaT_tuple_source_create().
+ *
+ * box.index.<...> constants are accepted as iterator types too.
+ *
+ * Push a table of matched tuples to a Lua stack on success.
+ * Raise error otherwise.
+ */
+static int
+lbox_key_def_filter(struct lua_State *L)
+{
+	box_key_def_t *key_def;
+	int top = lua_gettop(L);
+	if (top < 2 || top > 5 ||
+	    (key_def = luaT_check_key_def(L, 1)) == NULL ||
+	    (! lua_isnoneornil(L, 5) && ! lua_istable(L, 5))) {
+		return luaL_error(L, "Usage: key_def:filter(tuples, from_key, "
+				  "to_key[, {from = <iterator>, "
+				  "to = <iterator>, positions = <boolean>}])");
+	}
+	lua_settop(L, 5);
+
+	struct key_range range;
+	if (luaT_opts_iterator_type(L, 5, "from", ITER_GE,
+				    &range.from_type) != 0 ||
+	    luaT_opts_iterator_type(L, 5, "to", ITER_LE,
+				    &range.to_type) != 0)
+		return luaT_error(L);
+	if (range.from_type != ITER_EQ && range.from_type != ITER_GE &&
+	    range.from_type != ITER_GT) {
+		diag_set(ER_ILLEGAL_PARAMS, "from must be EQ, GE or GT");
+		return luaT_error(L);
+	}
+	if (range.to_type != ITER_LE && range.to_type != ITER_LT) {
+		diag_set(ER_ILLEGAL_PARAMS, "to must be LE or LT");
+		return luaT_error(L);
+	}
+	bool positions = luaT_opts_bool(L, 5, "positions");
+
+	range.from_key = NULL;
+	if (! lua_isnil(L, 3) &&
+	    (range.from_key = luaT_key_def_push_key(L, key_def, 3)) == NULL)
+		return luaT_error(L);
+	range.to_key = NULL;
+	if (! lua_isnil(L, 4) &&
+	    (range.to_key = luaT_key_def_push_key(L, key_def, 4)) == NULL)
+		return luaT_error(L);
+
+	struct tuple_source source;
+	if (luaT_tuple_source_create(L, 2, 5, &source) != 0)
+		return luaT_error(L);
+
+	lua_newtable(L);
+	int res_idx = lua_gettop(L);
+	uint32_t res_count = 0;
+	while (luaT_tuple_source_next(L, &source)) {
+		struct tuple *tuple = luaT_key_def_check_tuple(L, key_def,
+							       lua_gettop(L));
+		if (tuple == NULL)
+			return luaT_error(L);
+		bool match = key_range_contains(&range, tuple, key_def);
+		box_tuple_unref(tuple);
+		if (! match) {
+			lua_pop(L, 1);
+			continue;
+		}
+		if (positions) {
+			lua_pop(L, 1);
+			lua_pushinteger(L, source.count);
+		}
+		lua_rawseti(L, res_idx, ++res_count);
+	}
+	return 1;
+}
+
 /**
  * Construct and export to Lua a new key definition with a set
  * union of key parts from first and second key defs. Parts of
@@ -589,65 +1426,2871 @@ lbox_key_def_to_table(struct lua_State *L)
 	return 1;
 }
 
+/* {{{ Multikey key definitions */
+
 /**
- * Create a new key_def from a Lua table.
+ * Key definition with a multikey JSON path: a path with [*].
  *
- * Expected a table of key parts on the Lua stack. The format is
- * the same as box.space.<...>.index.<...>.parts or corresponding
- * net.box's one.
+ * Tarantool compares tuples using a multikey key definition
+ * only within an index, so box_tuple_compare() and friends can't
+ * be used with it. Such a key definition is a separate object,
+ * which methods work with keys of each array element.
+ */
+struct tuple_keydef_multikey {
+	box_key_def_t *key_def;
+	/** Compares extracted keys, see key_def_new_for_keys(). */
+	box_key_def_t *cmp_def;
+	/** Field with the multikey array. */
+	uint32_t fieldno;
+	/** JSON path of the array within the field. */
+	char *path;
+	uint32_t path_len;
+};
+
+/**
+ * Create a multikey key definition object. It takes ownership
+ * of @a key_def.
  *
- * Push the new key_def as cdata to a Lua stack.
+ * @a path is the multikey JSON path of the field @a fieldno.
+ *
+ * Return NULL and set a diag at a failure. @a key_def is deleted
+ * in the case.
  */
-static int
-lbox_key_def_new(struct lua_State *L)
+static struct tuple_keydef_multikey *
+tuple_keydef_multikey_new(box_key_def_t *key_def, uint32_t fieldno,
+			  const char *path)
 {
-	if (lua_gettop(L) != 1 || lua_istable(L, 1) != 1)
-		return luaL_error(L, "Bad params, use: tuple_keydef.new({"
-				  "{fieldno = fieldno, type = type"
-				  "[, is_nullable = <boolean>]"
-				  "[, path = <string>]"
-				  "[, collation = <string>]}, ...}");
-
-	uint32_t part_count = lua_objlen(L, 1);
-
-	size_t region_svp = box_region_used();
-	size_t size = sizeof(box_key_part_def_t) * part_count;
-	box_key_part_def_t *parts = box_region_aligned_alloc(
-		size, alignof(box_key_part_def_t));
-	if (parts == NULL) {
-		diag_set(ER_MEMORY_ISSUE, size, "box_region_aligned_alloc",
-			 "parts");
-		return luaT_error(L);
-	}
-	if (part_count == 0) {
-		diag_set(ER_ILLEGAL_PARAMS,
-			 "At least one key part is required");
-		return luaT_error(L);
+	uint32_t path_len = strstr(path, "[*]") - path;
+	struct tuple_keydef_multikey *multikey =
+		malloc(sizeof(*multikey) + path_len);
+	if (multikey == NULL) {
+		diag_set(ER_MEMORY_ISSUE,
+			 (unsigned)(sizeof(*multikey) + path_len), "malloc",
+			 "multikey key_def");
+		box_key_def_delete(key_def);
+		return NULL;
 	}
-
-	for (uint32_t i = 0; i < part_count; ++i) {
-		lua_rawgeti(L, 1, i + 1);
-		if (luaT_key_def_set_part(L, &parts[i]) != 0) {
-			box_region_truncate(region_svp);
-			return luaT_error(L);
-		}
-		lua_pop(L, 1);
+	multikey->cmp_def = key_def_new_for_keys(key_def);
+	if (multikey->cmp_def == NULL) {
+		box_key_def_delete(key_def);
+		free(multikey);
+		return NULL;
 	}
-
-	box_key_def_t *key_def = box_key_def_new_v2(parts, part_count);
-	box_region_truncate(region_svp);
-	if (key_def == NULL)
-		return luaT_error(L);
-
-	*(box_key_def_t **) luaL_pushcdata(L, CTID_STRUCT_TUPLE_KEY_DEF_REF) =
-		key_def;
-	lua_pushcfunction(L, lbox_key_def_gc);
-	luaL_setcdatagc(L, -2);
-
-	return 1;
+	multikey->key_def = key_def;
+	multikey->fieldno = fieldno;
+	multikey->path = (char *)(multikey + 1);
+	multikey->path_len = path_len;
+	memcpy(multikey->path, path, path_len);
+	return multikey;
 }
 
-/* {{{ Public API of the module */
+static void
+tuple_keydef_multikey_delete(struct tuple_keydef_multikey *multikey)
+{
+	box_key_def_delete(multikey->cmp_def);
+	box_key_def_delete(multikey->key_def);
+	free(multikey);
+}
+
+static struct tuple_keydef_multikey *
+luaT_check_multikey(struct lua_State *L, int idx)
+{
+	if (! luaL_iscdata(L, idx))
+		return NULL;
+
+	uint32_t cdata_type;
+	struct tuple_keydef_multikey **multikey_ptr =
+		luaL_checkcdata(L, idx, &cdata_type);
+	if (multikey_ptr == NULL ||
+	    cdata_type != CTID_STRUCT_TUPLE_KEYDEF_MULTIKEY_REF)
+		return NULL;
+	return *multikey_ptr;
+}
+
+/**
+ * Free a multikey key definition from a Lua code.
+ */
+static int
+lbox_multikey_gc(struct lua_State *L)
+{
+	struct tuple_keydef_multikey *multikey = luaT_check_multikey(L, 1);
+	assert(multikey != NULL);
+	tuple_keydef_multikey_delete(multikey);
+	return 0;
+}
+
+static void
+luaT_push_multikey(struct lua_State *L,
+		   struct tuple_keydef_multikey *multikey)
+{
+	*(struct tuple_keydef_multikey **)
+		luaL_pushcdata(L, CTID_STRUCT_TUPLE_KEYDEF_MULTIKEY_REF) =
+		multikey;
+	lua_pushcfunction(L, lbox_multikey_gc);
+	luaL_setcdatagc(L, -2);
+}
+
+/**
+ * Find a msgpack value by a JSON path relative to @a field.
+ * The path must be valid and must not contain [*].
+ *
+ * Return NULL, when there is no such value.
+ */
+static const char *
+mp_find_by_json_path(const char *field, const char *path, uint32_t len)
+{
+	const char *end = path + len;
+	const char *p = path;
+	while (p < end) {
+		const char *name = NULL;
+		uint32_t name_len = 0;
+		uint64_t index = 0;
+		if (*p == '[') {
+			++p;
+			if (*p == '"' || *p == '\'') {
+				char quote = *p++;
+				name = p;
+				while (p < end && *p != quote)
+					++p;
+				name_len = p - name;
+				++p;
+			} else {
+				while (p < end && *p >= '0' && *p <= '9')
+					index = index * 10 + (*p++ - '0');
+			}
+			/* Skip ']'. */
+			++p;
+		} else {
+			if (*p == '.')
+				++p;
+			name = p;
+			while (p < end && *p != '.' && *p != '[')
+				++p;
+			name_len = p - name;
+		}
+
+		if (mp_typeof(*field) == MP_ARRAY && name == NULL) {
+			uint32_t size = mp_decode_array(&field);
+			if (index < TUPLE_INDEX_BASE ||
+			    index - TUPLE_INDEX_BASE >= size)
+				return NULL;
+			for (uint64_t i = TUPLE_INDEX_BASE; i < index; ++i)
+				mp_next(&field);
+			continue;
+		}
+		if (mp_typeof(*field) != MP_MAP)
+			return NULL;
+		/*
+		 * Tarantool looks up a numeric token in a map as
+		 * a string key: [1] matches "1", but not 1.
+		 */
+		char index_str[24];
+		if (name == NULL) {
+			name_len = snprintf(index_str, sizeof(index_str),
+					    "%llu", (unsigned long long)index);
+			name = index_str;
+		}
+		uint32_t size = mp_decode_map(&field);
+		bool is_found = false;
+		for (uint32_t i = 0; i < size && ! is_found; ++i) {
+			if (mp_typeof(*field) == MP_STR) {
+				uint32_t key_len;
+				const char *key = mp_decode_str(&field,
+								&key_len);
+				is_found = key_len == name_len &&
+					   memcmp(key, name, name_len) == 0;
+			} else {
+				mp_next(&field);
+			}
+			if (! is_found)
+				mp_next(&field);
+		}
+		if (! is_found)
+			return NULL;
+	}
+	return field;
+}
+
+/**
+ * Number of elements in the multikey array of a tuple. Zero is
+ * returned, when there is no array.
+ */
+static uint32_t
+tuple_keydef_multikey_count(const struct tuple_keydef_multikey *multikey,
+			    box_tuple_t *tuple)
+{
+	const char *field = box_tuple_field(tuple, multikey->fieldno);
+	if (field == NULL)
+		return 0;
+	field = mp_find_by_json_path(field, multikey->path,
+				     multikey->path_len);
+	if (field == NULL || mp_typeof(*field) != MP_ARRAY)
+		return 0;
+	return mp_decode_array(&field);
+}
+
+/**
+ * Extract and validate a key of an element of the multikey
+ * array. The key is allocated on the box region.
+ *
+ * Return NULL and set a diag at a failure.
+ */
+static const char *
+tuple_keydef_multikey_extract(const struct tuple_keydef_multikey *multikey,
+			      box_tuple_t *tuple, uint32_t idx,
+			      uint32_t *key_size)
+{
+	const char *key = box_key_def_extract_key(multikey->key_def, tuple,
+						  idx, key_size);
+	if (key == NULL ||
+	    box_key_def_validate_full_key(multikey->cmp_def, key,
+					  NULL) != 0)
+		return NULL;
+	return key;
+}
+
+/**
+ * Get a tuple or a Lua table at @a idx as a tuple.
+ *
+ * The tuple can't be validated by a multikey key definition,
+ * keys are validated after extraction instead.
+ *
+ * Return the referenced tuple on success, otherwise return NULL
+ * and set a diag.
+ */
+static box_tuple_t *
+luaT_multikey_check_tuple(struct lua_State *L, int idx)
+{
+	box_tuple_t *tuple = luaT_istuple(L, idx);
+	if (tuple == NULL)
+		tuple = luaT_tuple_new(L, idx, box_tuple_format_default());
+	if (tuple == NULL)
+		return NULL;
+	box_tuple_ref(tuple);
+	return tuple;
+}
+
+/**
+ * Extract keys of all elements of the multikey array of a tuple
+ * in one pass.
+ *
+ * Push a table of key tuples to a Lua stack on success. Raise
+ * error otherwise.
+ */
+static int
+lbox_multikey_extract_keys(struct lua_State *L)
+{
+	struct tuple_keydef_multikey *multikey;
+	if (lua_gettop(L) != 2 ||
+	    (multikey = luaT_check_multikey(L, 1)) == NULL)
+		return luaL_error(L, "Usage: key_def:extract_keys_multikey("
+				  "tuple)");
+
+	box_tuple_t *tuple = luaT_multikey_check_tuple(L, 2);
+	if (tuple == NULL)
+		return luaT_error(L);
+	uint32_t count = tuple_keydef_multikey_count(multikey, tuple);
+	lua_createtable(L, count, 0);
+	for (uint32_t i = 0; i < count; ++i) {
+		size_t region_svp = box_region_used();
+		uint32_t key_size;
+		const char *key = tuple_keydef_multikey_extract(
+			multikey, tuple, i, &key_size);
+		box_tuple_t *ret = NULL;
+		if (key != NULL)
+			ret = box_tuple_new(box_tuple_format_default(), key,
+					    key + key_size);
+		box_region_truncate(region_svp);
+		if (ret == NULL) {
+			box_tuple_unref(tuple);
+			return luaT_error(L);
+		}
+		luaT_pushtuple(L, ret);
+		lua_rawseti(L, -2, i + 1);
+	}
+	box_tuple_unref(tuple);
+	return 1;
+}
+
+/**
+ * Compare a tuple with a (partial) key using the best matching
+ * element of the multikey array:
+ *
+ * - an element, which key is equal to the given one;
+ * - otherwise an element with the least key greater than the
+ *   given one: an index lower bound would stop on it;
+ * - otherwise an element with the greatest key.
+ *
+ * Push the comparison result (-1, 0 or 1 like
+ * key_def:compare_with_key()) and the element number to a Lua
+ * stack. Push nil, when the tuple has no elements. Raise error
+ * on an invalid tuple or key.
+ */
+static int
+lbox_multikey_compare_with_key(struct lua_State *L)
+{
+	struct tuple_keydef_multikey *multikey;
+	if (lua_gettop(L) != 3 ||
+	    (multikey = luaT_check_multikey(L, 1)) == NULL)
+		return luaL_error(L, "Usage: key_def:"
+				  "compare_with_key_multikey(tuple, key)");
+
+	struct key_search search;
+	if (luaT_key_search_create(L, 3, multikey->cmp_def,
+				   multikey->cmp_def, &search) != 0)
+		return luaT_error(L);
+	box_tuple_t *tuple = luaT_multikey_check_tuple(L, 2);
+	if (tuple == NULL) {
+		key_search_destroy(&search);
+		return luaT_error(L);
+	}
+	uint32_t count = tuple_keydef_multikey_count(multikey, tuple);
+
+	/* The key of the best element for comparisons. */
+	struct key_search best;
+	best.key = NULL;
+	best.cmp_def = multikey->cmp_def;
+	best.buf = NULL;
+	int best_cmp = 0;
+	uint32_t best_idx = 0;
+	int rc = -1;
+	for (uint32_t i = 0; i < count; ++i) {
+		size_t region_svp = box_region_used();
+		uint32_t key_size;
+		const char *key = tuple_keydef_multikey_extract(
+			multikey, tuple, i, &key_size);
+		/* A prefix of the key is not longer than the key. */
+		size_t buf_size = key_size + mp_sizeof_array(UINT32_MAX);
+		if (key != NULL &&
+		    (search.buf = box_region_alloc(buf_size)) == NULL)
+			diag_set(ER_MEMORY_ISSUE, (unsigned)buf_size,
+				 "box_region_alloc", "buf");
+		if (key == NULL || search.buf == NULL) {
+			box_region_truncate(region_svp);
+			goto out;
+		}
+		int cmp = key_search_cmp(key, key_size, &search);
+		if (cmp == 0) {
+			box_region_truncate(region_svp);
+			best_cmp = 0;
+			best_idx = i;
+			break;
+		}
+		bool is_better;
+		if (best.key == NULL)
+			is_better = true;
+		else if ((cmp > 0) != (best_cmp > 0))
+			is_better = cmp > 0;
+		else if (cmp > 0)
+			is_better = key_search_cmp(key, key_size, &best) < 0;
+		else
+			is_better = key_search_cmp(key, key_size, &best) > 0;
+		if (is_better) {
+			box_tuple_t *best_key = box_tuple_new(
+				box_tuple_format_default(), key,
+				key + key_size);
+			if (best_key == NULL) {
+				box_region_truncate(region_svp);
+				goto out;
+			}
+			box_tuple_ref(best_key);
+			if (best.key != NULL)
+				box_tuple_unref(best.key);
+			best.key = best_key;
+			best.part_count = box_tuple_field_count(best_key);
+			best_cmp = cmp;
+			best_idx = i;
+		}
+		box_region_truncate(region_svp);
+	}
+	rc = 0;
+out:
+	if (best.key != NULL)
+		box_tuple_unref(best.key);
+	box_tuple_unref(tuple);
+	key_search_destroy(&search);
+	if (rc != 0)
+		return luaT_error(L);
+	if (count == 0) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushinteger(L, best_cmp < 0 ? -1 : best_cmp > 0 ? 1 : 0);
+	lua_pushinteger(L, best_idx + TUPLE_INDEX_BASE);
+	return 2;
+}
+
+/**
+ * Push a new table representing a multikey key_def to a Lua
+ * stack.
+ */
+static int
+lbox_multikey_to_table(struct lua_State *L)
+{
+	struct tuple_keydef_multikey *multikey;
+	if (lua_gettop(L) != 1 ||
+	    (multikey = luaT_check_multikey(L, 1)) == NULL)
+		return luaL_error(L, "Usage: key_def:totable()");
+
+	luaT_key_def_to_table(L, multikey->key_def);
+	return 1;
+}
+
+/* }}} Multikey key definitions */
+
+/**
+ * Create a new key_def from a Lua table.
+ *
+ * Expected a table of key parts on the Lua stack. The format is
+ * the same as box.space.<...>.index.<...>.parts or corresponding
+ * net.box's one.
+ *
+ * Push the new key_def as cdata to a Lua stack.
+ */
+static int
+lbox_key_def_new(struct lua_State *L)
+{
+	if (lua_gettop(L) != 1 || lua_istable(L, 1) != 1)
+		return luaL_error(L, "Bad params, use: tuple_keydef.new({"
+				  "{fieldno = fieldno, type = type"
+				  "[, is_nullable = <boolean>]"
+				  "[, path = <string>]"
+				  "[, collation = <string>]}, ...}");
+
+	uint32_t part_count = lua_objlen(L, 1);
+
+	size_t region_svp = box_region_used();
+	size_t size = sizeof(box_key_part_def_t) * part_count;
+	box_key_part_def_t *parts = box_region_aligned_alloc(
+		size, alignof(box_key_part_def_t));
+	if (parts == NULL) {
+		diag_set(ER_MEMORY_ISSUE, size, "box_region_aligned_alloc",
+			 "parts");
+		return luaT_error(L);
+	}
+	if (part_count == 0) {
+		diag_set(ER_ILLEGAL_PARAMS,
+			 "At least one key part is required");
+		return luaT_error(L);
+	}
+
+	for (uint32_t i = 0; i < part_count; ++i) {
+		lua_rawgeti(L, 1, i + 1);
+		if (luaT_key_def_set_part(L, &parts[i]) != 0) {
+			box_region_truncate(region_svp);
+			return luaT_error(L);
+		}
+		lua_pop(L, 1);
+	}
+
+	/*
+	 * Tarantool verifies that all multikey parts point to
+	 * the same array, so remember the first one.
+	 */
+	const box_key_part_def_t *multikey_part = NULL;
+	for (uint32_t i = 0; i < part_count && JSON_PATH_IS_SUPPORTED; ++i) {
+		const char *path = JSON_PATH(&parts[i]);
+		if (path != NULL && json_path_is_multikey(path)) {
+			multikey_part = &parts[i];
+			break;
+		}
+	}
+
+	box_key_def_t *key_def = box_key_def_new_v2(parts, part_count);
+	if (key_def == NULL) {
+		box_region_truncate(region_svp);
+		return luaT_error(L);
+	}
+	if (multikey_part != NULL) {
+		struct tuple_keydef_multikey *multikey =
+			tuple_keydef_multikey_new(key_def,
+						  multikey_part->fieldno,
+						  JSON_PATH(multikey_part));
+		box_region_truncate(region_svp);
+		if (multikey == NULL)
+			return luaT_error(L);
+		luaT_push_multikey(L, multikey);
+		return 1;
+	}
+	box_region_truncate(region_svp);
+
+	*(box_key_def_t **) luaL_pushcdata(L, CTID_STRUCT_TUPLE_KEY_DEF_REF) =
+		key_def;
+	lua_pushcfunction(L, lbox_key_def_gc);
+	luaL_setcdatagc(L, -2);
+
+	return 1;
+}
+
+/* {{{ Bloom filter */
+
+/**
+ * Bloom filter over keys of a key definition.
+ */
+struct tuple_keydef_bloom {
+	/** Extracts keys from tuples and validates keys. */
+	box_key_def_t *key_def;
+	struct key_bloom bloom;
+};
+
+/** Format version of a serialized Bloom filter. */
+enum { TUPLE_KEYDEF_BLOOM_FORMAT_VERSION = 1 };
+
+/**
+ * Create a Bloom filter object.
+ *
+ * If @a block_count is zero, the filter is sized for
+ * @a key_count keys and @a fpr false positive rate. Otherwise
+ * it is created with the given geometry.
+ *
+ * Return NULL and set a diag at a failure.
+ */
+static struct tuple_keydef_bloom *
+tuple_keydef_bloom_new(const box_key_def_t *key_def, uint32_t key_count,
+		       double fpr, uint32_t block_count, uint32_t hash_count)
+{
+	struct tuple_keydef_bloom *bloom = malloc(sizeof(*bloom));
+	if (bloom == NULL) {
+		diag_set(ER_MEMORY_ISSUE, (unsigned)sizeof(*bloom), "malloc",
+			 "bloom");
+		return NULL;
+	}
+	bloom->key_def = key_def_dup(key_def);
+	if (bloom->key_def == NULL) {
+		free(bloom);
+		return NULL;
+	}
+	if (block_count == 0 &&
+	    key_bloom_geometry(key_count, fpr, &block_count,
+			       &hash_count) != 0) {
+		diag_set(ER_ILLEGAL_PARAMS, "Bloom filter is too large: too "
+			 "many keys or too small fpr");
+		goto error;
+	}
+	if (key_bloom_create_raw(&bloom->bloom, block_count,
+				 hash_count) != 0) {
+		diag_set(ER_MEMORY_ISSUE,
+			 (unsigned)(block_count * KEY_BLOOM_BLOCK_SIZE),
+			 "calloc", "bloom data");
+		goto error;
+	}
+	return bloom;
+error:
+	box_key_def_delete(bloom->key_def);
+	free(bloom);
+	return NULL;
+}
+
+static void
+tuple_keydef_bloom_delete(struct tuple_keydef_bloom *bloom)
+{
+	key_bloom_destroy(&bloom->bloom);
+	box_key_def_delete(bloom->key_def);
+	free(bloom);
+}
+
+static struct tuple_keydef_bloom *
+luaT_check_bloom(struct lua_State *L, int idx)
+{
+	if (! luaL_iscdata(L, idx))
+		return NULL;
+
+	uint32_t cdata_type;
+	struct tuple_keydef_bloom **bloom_ptr =
+		luaL_checkcdata(L, idx, &cdata_type);
+	if (bloom_ptr == NULL ||
+	    cdata_type != CTID_STRUCT_TUPLE_KEYDEF_BLOOM_REF)
+		return NULL;
+	return *bloom_ptr;
+}
+
+/**
+ * Free a Bloom filter from a Lua code.
+ */
+static int
+lbox_bloom_gc(struct lua_State *L)
+{
+	struct tuple_keydef_bloom *bloom = luaT_check_bloom(L, 1);
+	assert(bloom != NULL);
+	tuple_keydef_bloom_delete(bloom);
+	return 0;
+}
+
+static void
+luaT_push_bloom(struct lua_State *L, struct tuple_keydef_bloom *bloom)
+{
+	*(struct tuple_keydef_bloom **)
+		luaL_pushcdata(L, CTID_STRUCT_TUPLE_KEYDEF_BLOOM_REF) = bloom;
+	lua_pushcfunction(L, lbox_bloom_gc);
+	luaL_setcdatagc(L, -2);
+}
+
+/**
+ * Build a Bloom filter over keys of given tuples.
+ *
+ * Options:
+ *
+ * - fpr: false positive rate, 0.01 by default;
+ * - yield_every, yield_interval: see luaT_tuple_source_create().
+ *
+ * Push the new filter as cdata to a Lua stack on success.
+ * Raise error otherwise.
+ */
+static int
+lbox_key_def_build_bloom(struct lua_State *L)
+{
+	box_key_def_t *key_def;
+	int top = lua_gettop(L);
+	if (top < 2 || top > 3 ||
+	    (key_def = luaT_check_key_def(L, 1)) == NULL ||
+	    (! lua_isnoneornil(L, 3) && ! lua_istable(L, 3))) {
+		return luaL_error(L, "Usage: key_def:build_bloom(tuples"
+				  "[, {fpr = <number>}])");
+	}
+	lua_settop(L, 3);
+
+	double fpr;
+	if (luaT_opts_number(L, 3, "fpr", 0.01, &fpr) != 0)
+		return luaT_error(L);
+	if (! (fpr > 0 && fpr < 1)) {
+		diag_set(ER_ILLEGAL_PARAMS, "fpr must be in (0, 1)");
+		return luaT_error(L);
+	}
+	if (key_def_check_hashable(key_def) != 0)
+		return luaT_error(L);
+
+	struct tuple_source source;
+	if (luaT_tuple_source_create(L, 2, 3, &source) != 0)
+		return luaT_error(L);
+
+	/*
+	 * The number of keys is unknown for an iterator, so
+	 * collect hashes first and size the filter afterwards.
+	 *
+	 * The hashes are stored in a userdata to don't leak them
+	 * at an error raised by an iterator.
+	 */
+	uint32_t capacity = source.size > 16 ? source.size : 16;
+	uint64_t *hashes = lua_newuserdata(L, capacity * sizeof(uint64_t));
+	int hashes_idx = lua_gettop(L);
+	uint32_t count = 0;
+	while (luaT_tuple_source_next(L, &source)) {
+		uint64_t hash;
+		if (luaT_key_def_hash_tuple(L, key_def, lua_gettop(L),
+					    &hash) != 0)
+			return luaT_error(L);
+		lua_pop(L, 1);
+
+		if (count == capacity) {
+			capacity *= 2;
+			uint64_t *new_hashes = lua_newuserdata(
+				L, capacity * sizeof(uint64_t));
+			memcpy(new_hashes, hashes, count * sizeof(uint64_t));
+			lua_replace(L, hashes_idx);
+			hashes = new_hashes;
+		}
+		hashes[count++] = hash;
+	}
+
+	struct tuple_keydef_bloom *bloom =
+		tuple_keydef_bloom_new(key_def, count, fpr, 0, 0);
+	if (bloom == NULL)
+		return luaT_error(L);
+	for (uint32_t i = 0; i < count; ++i)
+		key_bloom_add(&bloom->bloom, hashes[i]);
+	luaT_push_bloom(L, bloom);
+	return 1;
+}
+
+/**
+ * Check whether a full key may be in the filter.
+ *
+ * Push false if the key is definitely absent, true otherwise.
+ * Raise error on an invalid key.
+ */
+static int
+lbox_bloom_maybe_contains(struct lua_State *L)
+{
+	struct tuple_keydef_bloom *bloom;
+	if (lua_gettop(L) != 2 || (bloom = luaT_check_bloom(L, 1)) == NULL)
+		return luaL_error(L, "Usage: bloom:maybe_contains(key)");
+
+	size_t region_svp = box_region_used();
+	const char *key = luaT_tuple_encode(L, 2, NULL);
+	if (key == NULL ||
+	    box_key_def_validate_full_key(bloom->key_def, key, NULL) != 0) {
+		box_region_truncate(region_svp);
+		return luaT_error(L);
+	}
+	uint64_t hash = key_hash_mp(key);
+	box_region_truncate(region_svp);
+	lua_pushboolean(L, key_bloom_maybe_has(&bloom->bloom, hash));
+	return 1;
+}
+
+/**
+ * Check whether a key of a tuple may be in the filter.
+ *
+ * Push false if the key is definitely absent, true otherwise.
+ * Raise error on an invalid tuple.
+ */
+static int
+lbox_bloom_maybe_contains_tuple(struct lua_State *L)
+{
+	struct tuple_keydef_bloom *bloom;
+	if (lua_gettop(L) != 2 || (bloom = luaT_check_bloom(L, 1)) == NULL)
+		return luaL_error(L, "Usage: bloom:maybe_contains_tuple("
+				  "tuple)");
+
+	uint64_t hash;
+	if (luaT_key_def_hash_tuple(L, bloom->key_def, 2, &hash) != 0)
+		return luaT_error(L);
+	lua_pushboolean(L, key_bloom_maybe_has(&bloom->bloom, hash));
+	return 1;
+}
+
+/**
+ * Serialize a Bloom filter into msgpack:
+ *
+ * [<format version>, <hash count>, <block count>, <bit array>]
+ *
+ * Push the result as a string to a Lua stack.
+ */
+static int
+lbox_bloom_serialize(struct lua_State *L)
+{
+	struct tuple_keydef_bloom *bloom;
+	if (lua_gettop(L) != 1 || (bloom = luaT_check_bloom(L, 1)) == NULL)
+		return luaL_error(L, "Usage: bloom:serialize()");
+
+	const struct key_bloom *b = &bloom->bloom;
+	size_t data_size = key_bloom_data_size(b);
+	size_t size = mp_sizeof_array(4) +
+		      mp_sizeof_uint(TUPLE_KEYDEF_BLOOM_FORMAT_VERSION) +
+		      mp_sizeof_uint(b->hash_count) +
+		      mp_sizeof_uint(b->block_count) +
+		      mp_sizeof_bin(data_size);
+
+	size_t region_svp = box_region_used();
+	char *buf = box_region_alloc(size);
+	if (buf == NULL) {
+		diag_set(ER_MEMORY_ISSUE, (unsigned)size, "box_region_alloc",
+			 "buf");
+		return luaT_error(L);
+	}
+	char *p = mp_encode_array(buf, 4);
+	p = mp_encode_uint(p, TUPLE_KEYDEF_BLOOM_FORMAT_VERSION);
+	p = mp_encode_uint(p, b->hash_count);
+	p = mp_encode_uint(p, b->block_count);
+	p = mp_encode_bin(p, (const char *)b->data, data_size);
+	assert((size_t)(p - buf) == size);
+	lua_pushlstring(L, buf, size);
+	box_region_truncate(region_svp);
+	return 1;
+}
+
+/**
+ * Create a Bloom filter from the result of bloom:serialize().
+ *
+ * Push the new filter as cdata to a Lua stack on success.
+ * Raise error otherwise.
+ */
+static int
+lbox_key_def_deserialize_bloom(struct lua_State *L)
+{
+	box_key_def_t *key_def;
+	if (lua_gettop(L) != 2 ||
+	    (key_def = luaT_check_key_def(L, 1)) == NULL ||
+	    lua_type(L, 2) != LUA_TSTRING)
+		return luaL_error(L, "Usage: key_def:deserialize_bloom(data)");
+
+	if (key_def_check_hashable(key_def) != 0)
+		return luaT_error(L);
+
+	size_t len;
+	const char *data = lua_tolstring(L, 2, &len);
+	const char *p = data;
+	if (mp_check(&p, data + len) != 0 || p != data + len)
+		goto invalid;
+
+	p = data;
+	if (mp_typeof(*p) != MP_ARRAY || mp_decode_array(&p) != 4)
+		goto invalid;
+	if (mp_typeof(*p) != MP_UINT ||
+	    mp_decode_uint(&p) != TUPLE_KEYDEF_BLOOM_FORMAT_VERSION)
+		goto invalid;
+	if (mp_typeof(*p) != MP_UINT)
+		goto invalid;
+	uint64_t hash_count = mp_decode_uint(&p);
+	if (hash_count < 1 || hash_count > KEY_BLOOM_HASH_COUNT_MAX)
+		goto invalid;
+	if (mp_typeof(*p) != MP_UINT)
+		goto invalid;
+	uint64_t block_count = mp_decode_uint(&p);
+	if (block_count < 1 || block_count > KEY_BLOOM_BLOCK_COUNT_MAX)
+		goto invalid;
+	if (mp_typeof(*p) != MP_BIN)
+		goto invalid;
+	uint32_t data_size;
+	const char *bits = mp_decode_bin(&p, &data_size);
+	if (data_size != block_count * KEY_BLOOM_BLOCK_SIZE)
+		goto invalid;
+
+	struct tuple_keydef_bloom *bloom = tuple_keydef_bloom_new(
+		key_def, 0, 0, block_count, hash_count);
+	if (bloom == NULL)
+		return luaT_error(L);
+	memcpy(bloom->bloom.data, bits, data_size);
+	luaT_push_bloom(L, bloom);
+	return 1;
+
+invalid:
+	diag_set(ER_ILLEGAL_PARAMS, "Invalid Bloom filter data");
+	return luaT_error(L);
+}
+
+/* }}} Bloom filter */
+
+/* {{{ HyperLogLog */
+
+/**
+ * HyperLogLog sketch over keys of a key definition.
+ */
+struct tuple_keydef_hll {
+	/** Extracts keys from tuples. */
+	box_key_def_t *key_def;
+	struct key_hll hll;
+};
+
+/** Format version of a serialized sketch. */
+enum { TUPLE_KEYDEF_HLL_FORMAT_VERSION = 1 };
+
+enum { TUPLE_KEYDEF_HLL_PRECISION_DEFAULT = 14 };
+
+/**
+ * Create an empty sketch.
+ *
+ * Return NULL and set a diag at a failure.
+ */
+static struct tuple_keydef_hll *
+tuple_keydef_hll_new(const box_key_def_t *key_def, uint32_t precision)
+{
+	struct tuple_keydef_hll *hll = malloc(sizeof(*hll));
+	if (hll == NULL) {
+		diag_set(ER_MEMORY_ISSUE, (unsigned)sizeof(*hll), "malloc",
+			 "hll");
+		return NULL;
+	}
+	hll->key_def = key_def_dup(key_def);
+	if (hll->key_def == NULL) {
+		free(hll);
+		return NULL;
+	}
+	if (key_hll_create(&hll->hll, precision) != 0) {
+		diag_set(ER_MEMORY_ISSUE, 1u << precision, "malloc",
+			 "hll registers");
+		box_key_def_delete(hll->key_def);
+		free(hll);
+		return NULL;
+	}
+	return hll;
+}
+
+static void
+tuple_keydef_hll_delete(struct tuple_keydef_hll *hll)
+{
+	key_hll_destroy(&hll->hll);
+	box_key_def_delete(hll->key_def);
+	free(hll);
+}
+
+static struct tuple_keydef_hll *
+luaT_check_hll(struct lua_State *L, int idx)
+{
+	if (! luaL_iscdata(L, idx))
+		return NULL;
+
+	uint32_t cdata_type;
+	struct tuple_keydef_hll **hll_ptr =
+		luaL_checkcdata(L, idx, &cdata_type);
+	if (hll_ptr == NULL || cdata_type != CTID_STRUCT_TUPLE_KEYDEF_HLL_REF)
+		return NULL;
+	return *hll_ptr;
+}
+
+/**
+ * Free a sketch from a Lua code.
+ */
+static int
+lbox_hll_gc(struct lua_State *L)
+{
+	struct tuple_keydef_hll *hll = luaT_check_hll(L, 1);
+	assert(hll != NULL);
+	tuple_keydef_hll_delete(hll);
+	return 0;
+}
+
+static void
+luaT_push_hll(struct lua_State *L, struct tuple_keydef_hll *hll)
+{
+	*(struct tuple_keydef_hll **)
+		luaL_pushcdata(L, CTID_STRUCT_TUPLE_KEYDEF_HLL_REF) = hll;
+	lua_pushcfunction(L, lbox_hll_gc);
+	luaL_setcdatagc(L, -2);
+}
+
+/**
+ * Create an empty HyperLogLog sketch over keys.
+ *
+ * Options:
+ *
+ * - precision: 4..18, 14 by default. The sketch occupies
+ *   2^precision bytes, the standard error of the estimation is
+ *   1.04 / sqrt(2^precision).
+ *
+ * Key parts with a collation are rejected: there is no way to
+ * hash strings equal by a collation to the same value using the
+ * module API.
+ *
+ * Push the new sketch as cdata to a Lua stack on success.
+ * Raise error otherwise.
+ */
+static int
+lbox_key_def_hll(struct lua_State *L)
+{
+	box_key_def_t *key_def;
+	int top = lua_gettop(L);
+	if (top < 1 || top > 2 ||
+	    (key_def = luaT_check_key_def(L, 1)) == NULL ||
+	    (! lua_isnoneornil(L, 2) && ! lua_istable(L, 2)))
+		return luaL_error(L, "Usage: key_def:hll([{precision = "
+				  "<number>}])");
+	lua_settop(L, 2);
+
+	double precision;
+	if (luaT_opts_number(L, 2, "precision",
+			     TUPLE_KEYDEF_HLL_PRECISION_DEFAULT,
+			     &precision) != 0)
+		return luaT_error(L);
+	if (! (precision >= KEY_HLL_PRECISION_MIN &&
+	       precision <= KEY_HLL_PRECISION_MAX) ||
+	    precision != floor(precision)) {
+		diag_set(ER_ILLEGAL_PARAMS, "precision must be an integer "
+			 "in [%d, %d]", KEY_HLL_PRECISION_MIN,
+			 KEY_HLL_PRECISION_MAX);
+		return luaT_error(L);
+	}
+	if (key_def_check_hashable(key_def) != 0)
+		return luaT_error(L);
+
+	struct tuple_keydef_hll *hll =
+		tuple_keydef_hll_new(key_def, precision);
+	if (hll == NULL)
+		return luaT_error(L);
+	luaT_push_hll(L, hll);
+	return 1;
+}
+
+/**
+ * Add a key of a tuple to a sketch.
+ *
+ * Raise error on an invalid tuple.
+ */
+static int
+lbox_hll_add(struct lua_State *L)
+{
+	struct tuple_keydef_hll *hll;
+	if (lua_gettop(L) != 2 || (hll = luaT_check_hll(L, 1)) == NULL)
+		return luaL_error(L, "Usage: hll:add(tuple)");
+
+	uint64_t hash;
+	if (luaT_key_def_hash_tuple(L, hll->key_def, 2, &hash) != 0)
+		return luaT_error(L);
+	key_hll_add(&hll->hll, hash);
+	return 0;
+}
+
+/**
+ * Add keys of given tuples to a sketch.
+ *
+ * Options: yield_every, yield_interval, see
+ * luaT_tuple_source_create().
+ *
+ * Keys of tuples before an invalid one are added. Raise error on
+ * an invalid tuple.
+ */
+static int
+lbox_hll_add_many(struct lua_State *L)
+{
+	struct tuple_keydef_hll *hll;
+	int top = lua_gettop(L);
+	if (top < 2 || top > 3 || (hll = luaT_check_hll(L, 1)) == NULL ||
+	    (! lua_isnoneornil(L, 3) && ! lua_istable(L, 3)))
+		return luaL_error(L, "Usage: hll:add_many(tuples[, opts])");
+	lua_settop(L, 3);
+
+	struct tuple_source source;
+	if (luaT_tuple_source_create(L, 2, 3, &source) != 0)
+		return luaT_error(L);
+	while (luaT_tuple_source_next(L, &source)) {
+		uint64_t hash;
+		if (luaT_key_def_hash_tuple(L, hll->key_def, lua_gettop(L),
+					    &hash) != 0)
+			return luaT_error(L);
+		key_hll_add(&hll->hll, hash);
+		lua_pop(L, 1);
+	}
+	return 0;
+}
+
+/**
+ * Add keys of another sketch (say, from another shard) to a
+ * sketch. The sketches must have the same precision.
+ *
+ * The key definitions are not compared: it is up to a caller to
+ * merge sketches over the same keys.
+ */
+static int
+lbox_hll_merge(struct lua_State *L)
+{
+	struct tuple_keydef_hll *hll;
+	struct tuple_keydef_hll *other;
+	if (lua_gettop(L) != 2 || (hll = luaT_check_hll(L, 1)) == NULL ||
+	    (other = luaT_check_hll(L, 2)) == NULL)
+		return luaL_error(L, "Usage: hll:merge(other)");
+
+	if (hll->hll.precision != other->hll.precision) {
+		diag_set(ER_ILLEGAL_PARAMS, "Can't merge sketches with "
+			 "different precision: %u and %u",
+			 (unsigned)hll->hll.precision,
+			 (unsigned)other->hll.precision);
+		return luaT_error(L);
+	}
+	key_hll_merge(&hll->hll, &other->hll);
+	return 0;
+}
+
+/**
+ * Push an estimation of the number of distinct keys in a sketch
+ * to a Lua stack.
+ */
+static int
+lbox_hll_estimate(struct lua_State *L)
+{
+	struct tuple_keydef_hll *hll;
+	if (lua_gettop(L) != 1 || (hll = luaT_check_hll(L, 1)) == NULL)
+		return luaL_error(L, "Usage: hll:estimate()");
+
+	lua_pushnumber(L, key_hll_estimate(&hll->hll));
+	return 1;
+}
+
+/**
+ * Serialize a sketch into msgpack:
+ *
+ * [<format version>, <precision>, <registers>]
+ *
+ * Push the result as a string to a Lua stack.
+ */
+static int
+lbox_hll_serialize(struct lua_State *L)
+{
+	struct tuple_keydef_hll *hll;
+	if (lua_gettop(L) != 1 || (hll = luaT_check_hll(L, 1)) == NULL)
+		return luaL_error(L, "Usage: hll:serialize()");
+
+	const struct key_hll *h = &hll->hll;
+	uint32_t register_count = key_hll_register_count(h);
+	size_t size = mp_sizeof_array(3) +
+		      mp_sizeof_uint(TUPLE_KEYDEF_HLL_FORMAT_VERSION) +
+		      mp_sizeof_uint(h->precision) +
+		      mp_sizeof_bin(register_count);
+
+	size_t region_svp = box_region_used();
+	char *buf = box_region_alloc(size);
+	if (buf == NULL) {
+		diag_set(ER_MEMORY_ISSUE, (unsigned)size, "box_region_alloc",
+			 "buf");
+		return luaT_error(L);
+	}
+	char *p = mp_encode_array(buf, 3);
+	p = mp_encode_uint(p, TUPLE_KEYDEF_HLL_FORMAT_VERSION);
+	p = mp_encode_uint(p, h->precision);
+	p = mp_encode_bin(p, (const char *)h->registers, register_count);
+	assert((size_t)(p - buf) == size);
+	lua_pushlstring(L, buf, size);
+	box_region_truncate(region_svp);
+	return 1;
+}
+
+/**
+ * Create a sketch from the result of hll:serialize().
+ *
+ * Push the new sketch as cdata to a Lua stack on success.
+ * Raise error otherwise.
+ */
+static int
+lbox_key_def_deserialize_hll(struct lua_State *L)
+{
+	box_key_def_t *key_def;
+	if (lua_gettop(L) != 2 ||
+	    (key_def = luaT_check_key_def(L, 1)) == NULL ||
+	    lua_type(L, 2) != LUA_TSTRING)
+		return luaL_error(L, "Usage: key_def:deserialize_hll(data)");
+
+	if (key_def_check_hashable(key_def) != 0)
+		return luaT_error(L);
+
+	size_t len;
+	const char *data = lua_tolstring(L, 2, &len);
+	const char *p = data;
+	if (mp_check(&p, data + len) != 0 || p != data + len)
+		goto invalid;
+
+	p = data;
+	if (mp_typeof(*p) != MP_ARRAY || mp_decode_array(&p) != 3)
+		goto invalid;
+	if (mp_typeof(*p) != MP_UINT ||
+	    mp_decode_uint(&p) != TUPLE_KEYDEF_HLL_FORMAT_VERSION)
+		goto invalid;
+	if (mp_typeof(*p) != MP_UINT)
+		goto invalid;
+	uint64_t precision = mp_decode_uint(&p);
+	if (precision < KEY_HLL_PRECISION_MIN ||
+	    precision > KEY_HLL_PRECISION_MAX)
+		goto invalid;
+	if (mp_typeof(*p) != MP_BIN)
+		goto invalid;
+	uint32_t register_count;
+	const char *registers = mp_decode_bin(&p, &register_count);
+	if (register_count != 1u << precision)
+		goto invalid;
+	/* A rank can't exceed the number of hash bits left. */
+	for (uint32_t i = 0; i < register_count; ++i) {
+		if ((uint8_t)registers[i] > 64 - precision + 1)
+			goto invalid;
+	}
+
+	struct tuple_keydef_hll *hll = tuple_keydef_hll_new(key_def,
+							    precision);
+	if (hll == NULL)
+		return luaT_error(L);
+	memcpy(hll->hll.registers, registers, register_count);
+	luaT_push_hll(L, hll);
+	return 1;
+
+invalid:
+	diag_set(ER_ILLEGAL_PARAMS, "Invalid HyperLogLog sketch data");
+	return luaT_error(L);
+}
+
+/* }}} HyperLogLog */
+
+/* {{{ Raw msgpack batches */
+
+/**
+ * Decode a batch: a msgpack array of tuples.
+ *
+ * Set *tuples to the first tuple and *count to the number of
+ * tuples. Return 0 on success, otherwise return -1 and set a
+ * diag.
+ */
+static int
+mp_decode_batch(const char *data, size_t len, const char **tuples,
+		uint32_t *count)
+{
+	const char *p = data;
+	if (len == 0 || mp_typeof(*p) != MP_ARRAY ||
+	    mp_check(&p, data + len) != 0 || p != data + len)
+		goto invalid;
+
+	p = data;
+	*count = mp_decode_array(&p);
+	*tuples = p;
+	for (uint32_t i = 0; i < *count; ++i) {
+		if (mp_typeof(*p) != MP_ARRAY)
+			goto invalid;
+		mp_next(&p);
+	}
+	return 0;
+
+invalid:
+	diag_set(ER_ILLEGAL_PARAMS, "Expected a msgpack array of tuples");
+	return -1;
+}
+
+struct sort_item {
+	box_tuple_t *tuple;
+	/** Zero based position in the batch. */
+	uint32_t pos;
+};
+
+/**
+ * Compare items using a key definition passed as @a arg.
+ * Equal tuples are ordered by their positions to make the
+ * sorting stable.
+ */
+static int
+sort_item_cmp(const void *a, const void *b, void *arg)
+{
+	const struct sort_item *item_a = a;
+	const struct sort_item *item_b = b;
+	int rc = box_tuple_compare(item_a->tuple, item_b->tuple, arg);
+	if (rc != 0)
+		return rc;
+	return item_a->pos < item_b->pos ? -1 : item_a->pos > item_b->pos;
+}
+
+/**
+ * Key fields of a batch, which is sorted in a coio thread.
+ *
+ * The box API is available only in the tx thread: say, a tuple
+ * comparator looks up a tuple format in a global table, which
+ * may be reallocated meanwhile. So the coio thread compares
+ * key fields as msgpack.
+ */
+struct sort_raw {
+	/** Key fields of i-th tuple: fields[i * part_count + j]. */
+	const char **fields;
+	uint32_t part_count;
+};
+
+/**
+ * Classes of values in the order of tarantool's comparison of
+ * values of different types (say, within a 'scalar' part).
+ */
+enum sort_class {
+	SORT_CLASS_NIL,
+	SORT_CLASS_BOOL,
+	SORT_CLASS_NUMBER,
+	SORT_CLASS_STR,
+	SORT_CLASS_BIN,
+	/** Values, which can't be compared as msgpack. */
+	SORT_CLASS_OTHER,
+};
+
+static enum sort_class
+sort_classof(enum mp_type type)
+{
+	switch (type) {
+	case MP_NIL:
+		return SORT_CLASS_NIL;
+	case MP_BOOL:
+		return SORT_CLASS_BOOL;
+	case MP_UINT:
+	case MP_INT:
+	case MP_FLOAT:
+	case MP_DOUBLE:
+		return SORT_CLASS_NUMBER;
+	case MP_STR:
+		return SORT_CLASS_STR;
+	case MP_BIN:
+		return SORT_CLASS_BIN;
+	default:
+		return SORT_CLASS_OTHER;
+	}
+}
+
+/**
+ * Compare a non-negative integer with a double. NaN is less
+ * than any number.
+ */
+static int
+sort_compare_uint_double(uint64_t u, double d)
+{
+	if (isnan(d) || d < 0)
+		return 1;
+	if (d >= 18446744073709551616.0)
+		return -1;
+	uint64_t t = (uint64_t)d;
+	if (u != t)
+		return u < t ? -1 : 1;
+	return d > (double)t ? -1 : 0;
+}
+
+/**
+ * Compare a negative integer with a double. NaN is less than
+ * any number.
+ */
+static int
+sort_compare_int_double(int64_t i, double d)
+{
+	if (isnan(d) || d < -9223372036854775808.0)
+		return 1;
+	if (d >= 0)
+		return -1;
+	int64_t t = (int64_t)d;
+	if (i != t)
+		return i < t ? -1 : 1;
+	return d < (double)t ? 1 : 0;
+}
+
+/**
+ * Compare a double with a number. NaN is less than any number.
+ */
+static int
+sort_compare_double(double d, const char *field)
+{
+	switch (mp_typeof(*field)) {
+	case MP_UINT:
+		return -sort_compare_uint_double(mp_decode_uint(&field), d);
+	case MP_INT: {
+		int64_t i = mp_decode_int(&field);
+		if (i >= 0)
+			return -sort_compare_uint_double(i, d);
+		return -sort_compare_int_double(i, d);
+	}
+	default:
+		break;
+	}
+	double v = mp_typeof(*field) == MP_FLOAT ?
+		   mp_decode_float(&field) : mp_decode_double(&field);
+	if (isnan(d) || isnan(v))
+		return isnan(v) - isnan(d);
+	return d < v ? -1 : d > v;
+}
+
+/** Compare two numbers given as msgpack. */
+static int
+sort_compare_number(const char *a, const char *b)
+{
+	switch (mp_typeof(*a)) {
+	case MP_FLOAT:
+		return sort_compare_double(mp_decode_float(&a), b);
+	case MP_DOUBLE:
+		return sort_compare_double(mp_decode_double(&a), b);
+	default:
+		break;
+	}
+	switch (mp_typeof(*b)) {
+	case MP_FLOAT:
+	case MP_DOUBLE:
+		return -sort_compare_number(b, a);
+	default:
+		break;
+	}
+	/* Both are integers. */
+	bool a_is_int = mp_typeof(*a) == MP_INT;
+	bool b_is_int = mp_typeof(*b) == MP_INT;
+	int64_t ia = a_is_int ? mp_decode_int(&a) : 0;
+	int64_t ib = b_is_int ? mp_decode_int(&b) : 0;
+	if (ia < 0 || ib < 0)
+		return ia < ib ? -1 : ia > ib;
+	uint64_t ua = a_is_int ? (uint64_t)ia : mp_decode_uint(&a);
+	uint64_t ub = b_is_int ? (uint64_t)ib : mp_decode_uint(&b);
+	return ua < ub ? -1 : ua > ub;
+}
+
+/**
+ * Compare two key fields as tarantool does for parts without a
+ * collation. The fields must not be of SORT_CLASS_OTHER.
+ */
+static int
+sort_compare_field(const char *a, const char *b)
+{
+	enum sort_class class_a = sort_classof(mp_typeof(*a));
+	enum sort_class class_b = sort_classof(mp_typeof(*b));
+	if (class_a != class_b)
+		return class_a < class_b ? -1 : 1;
+	const char *data_a, *data_b;
+	uint32_t len_a, len_b;
+	switch (class_a) {
+	case SORT_CLASS_NIL:
+		return 0;
+	case SORT_CLASS_BOOL:
+		return (int)mp_decode_bool(&a) - (int)mp_decode_bool(&b);
+	case SORT_CLASS_NUMBER:
+		return sort_compare_number(a, b);
+	case SORT_CLASS_STR:
+		data_a = mp_decode_str(&a, &len_a);
+		data_b = mp_decode_str(&b, &len_b);
+		break;
+	default:
+		assert(class_a == SORT_CLASS_BIN);
+		data_a = mp_decode_bin(&a, &len_a);
+		data_b = mp_decode_bin(&b, &len_b);
+		break;
+	}
+	int rc = memcmp(data_a, data_b, len_a < len_b ? len_a : len_b);
+	if (rc != 0)
+		return rc;
+	return len_a < len_b ? -1 : len_a > len_b;
+}
+
+/**
+ * Compare items by key fields of struct sort_raw passed as
+ * @a arg. Equal tuples are ordered by their positions.
+ */
+static int
+sort_item_cmp_raw(const void *a, const void *b, void *arg)
+{
+	const struct sort_item *item_a = a;
+	const struct sort_item *item_b = b;
+	const struct sort_raw *raw = arg;
+	const char **fields_a = raw->fields +
+				(size_t)item_a->pos * raw->part_count;
+	const char **fields_b = raw->fields +
+				(size_t)item_b->pos * raw->part_count;
+	for (uint32_t i = 0; i < raw->part_count; ++i) {
+		int rc = sort_compare_field(fields_a[i], fields_b[i]);
+		if (rc != 0)
+			return rc;
+	}
+	return item_a->pos < item_b->pos ? -1 : item_a->pos > item_b->pos;
+}
+
+/**
+ * Store key fields of a raw tuple, which is the @a pos-th one
+ * in a batch. A missing field is stored as nil.
+ *
+ * @a fieldnos are zero based field numbers of key parts.
+ *
+ * Return 0 on success, otherwise return -1 and set a diag.
+ */
+static int
+sort_raw_add(struct sort_raw *raw, uint32_t pos, const char *tuple,
+	     const uint32_t *fieldnos)
+{
+	static const char mp_nil = '\xc0';
+
+	const char **fields = raw->fields + (size_t)pos * raw->part_count;
+	for (uint32_t i = 0; i < raw->part_count; ++i)
+		fields[i] = &mp_nil;
+	uint32_t field_count = mp_decode_array(&tuple);
+	for (uint32_t fieldno = 0; fieldno < field_count; ++fieldno) {
+		for (uint32_t i = 0; i < raw->part_count; ++i) {
+			if (fieldnos[i] == fieldno)
+				fields[i] = tuple;
+		}
+		mp_next(&tuple);
+	}
+	for (uint32_t i = 0; i < raw->part_count; ++i) {
+		if (sort_classof(mp_typeof(*fields[i])) == SORT_CLASS_OTHER) {
+			diag_set(ER_ILLEGAL_PARAMS, "Only nil, boolean, "
+				 "number, string and varbinary key fields "
+				 "are supported in the async mode");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Sort items in a coio thread.
+ *
+ * Only the items and the key fields are accessed here: no box
+ * API calls (see struct sort_raw). The msgpack is anchored by
+ * the waiting fiber.
+ */
+static ssize_t
+sort_items_f(va_list ap)
+{
+	struct sort_item *items = va_arg(ap, struct sort_item *);
+	uint32_t count = va_arg(ap, uint32_t);
+	struct sort_raw *raw = va_arg(ap, struct sort_raw *);
+	qsort_arg(items, count, sizeof(*items), sort_item_cmp_raw, raw);
+	return 0;
+}
+
+/**
+ * Sort a msgpack array of tuples and return a permutation: the
+ * original positions of tuples in the sorted order. The sorting
+ * is stable.
+ *
+ * Options:
+ *
+ * - async: sort in a coio thread. The fiber waits for the
+ *   result without blocking the event loop. Tuples are still
+ *   validated in the tx thread, but compared as msgpack in the
+ *   coio one. So key parts with a collation or a JSON path and
+ *   key fields of extension types (decimal, uuid and so on) are
+ *   not supported in the mode.
+ *
+ * Push a table of one based positions to a Lua stack on success.
+ * Raise error otherwise.
+ */
+static int
+lbox_key_def_sort_permutation(struct lua_State *L)
+{
+	box_key_def_t *key_def;
+	int top = lua_gettop(L);
+	if (top < 2 || top > 3 ||
+	    (key_def = luaT_check_key_def(L, 1)) == NULL ||
+	    lua_type(L, 2) != LUA_TSTRING ||
+	    (! lua_isnoneornil(L, 3) && ! lua_istable(L, 3))) {
+		return luaL_error(L, "Usage: key_def:sort_permutation(data"
+				  "[, {async = <boolean>}])");
+	}
+	lua_settop(L, 3);
+
+	bool async = luaT_opts_bool(L, 3, "async");
+	if (async) {
+		bool has_collation;
+		if (key_def_has_collation(key_def, &has_collation) != 0)
+			return luaT_error(L);
+		if (has_collation) {
+			diag_set(ER_ILLEGAL_PARAMS, "Sorting of a key part "
+				 "with a collation is not supported in the "
+				 "async mode");
+			return luaT_error(L);
+		}
+	}
+
+	size_t len;
+	const char *data = lua_tolstring(L, 2, &len);
+	const char *p;
+	uint32_t count;
+	if (mp_decode_batch(data, len, &p, &count) != 0)
+		return luaT_error(L);
+
+	/* Create it before the tuples to don't leak them at OOM. */
+	lua_createtable(L, count, 0);
+
+	size_t region_svp = box_region_used();
+	size_t size = sizeof(struct sort_item) * count;
+	struct sort_item *items = box_region_aligned_alloc(
+		size, alignof(struct sort_item));
+	if (items == NULL && count > 0) {
+		diag_set(ER_MEMORY_ISSUE, (unsigned)size,
+			 "box_region_aligned_alloc", "items");
+		return luaT_error(L);
+	}
+
+	struct sort_raw raw;
+	uint32_t *fieldnos = NULL;
+	if (async) {
+		box_key_part_def_t *parts = box_key_def_dump_parts(
+			key_def, &raw.part_count);
+		if (parts == NULL) {
+			box_region_truncate(region_svp);
+			return luaT_error(L);
+		}
+		size = sizeof(uint32_t) * raw.part_count;
+		fieldnos = box_region_aligned_alloc(size, alignof(uint32_t));
+		if (fieldnos == NULL) {
+			box_region_truncate(region_svp);
+			diag_set(ER_MEMORY_ISSUE, (unsigned)size,
+				 "box_region_aligned_alloc", "fieldnos");
+			return luaT_error(L);
+		}
+		for (uint32_t i = 0; i < raw.part_count; ++i) {
+			if (JSON_PATH(&parts[i]) != NULL) {
+				box_region_truncate(region_svp);
+				diag_set(ER_ILLEGAL_PARAMS, "Sorting of a key "
+					 "part with a JSON path is not "
+					 "supported in the async mode");
+				return luaT_error(L);
+			}
+			fieldnos[i] = parts[i].fieldno;
+		}
+		size = sizeof(const char *) * count * raw.part_count;
+		raw.fields = box_region_aligned_alloc(size,
+						      alignof(const char *));
+		if (raw.fields == NULL && size > 0) {
+			box_region_truncate(region_svp);
+			diag_set(ER_MEMORY_ISSUE, (unsigned)size,
+				 "box_region_aligned_alloc", "fields");
+			return luaT_error(L);
+		}
+	}
+
+	uint32_t created = 0;
+	int rc = 0;
+	for (; created < count; ++created) {
+		const char *end = p;
+		mp_next(&end);
+		box_tuple_t *tuple = box_tuple_new(box_tuple_format_default(),
+						   p, end);
+		if (tuple == NULL) {
+			rc = -1;
+			break;
+		}
+		box_tuple_ref(tuple);
+		items[created].tuple = tuple;
+		items[created].pos = created;
+		if (box_key_def_validate_tuple(key_def, tuple) != 0 ||
+		    (async && sort_raw_add(&raw, created, p, fieldnos) != 0)) {
+			++created;
+			rc = -1;
+			break;
+		}
+		p = end;
+	}
+
+	if (rc == 0 && async) {
+		if (coio_call(sort_items_f, items, count, &raw) != 0) {
+			diag_set(ER_PROC_C, "Failed to run a coio task: %s",
+				 strerror(errno));
+			rc = -1;
+		}
+	} else if (rc == 0) {
+		qsort_arg(items, count, sizeof(*items), sort_item_cmp, key_def);
+	}
+
+	for (uint32_t i = 0; i < created; ++i)
+		box_tuple_unref(items[i].tuple);
+	if (rc != 0) {
+		box_region_truncate(region_svp);
+		return luaT_error(L);
+	}
+	for (uint32_t i = 0; i < count; ++i) {
+		lua_pushinteger(L, items[i].pos + 1);
+		lua_rawseti(L, -2, i + 1);
+	}
+	box_region_truncate(region_svp);
+	return 1;
+}
+
+struct hash_partition_task {
+	/** The first tuple of a batch. */
+	const char *tuples;
+	uint32_t tuple_count;
+	/** Zero based field numbers of key parts. */
+	const uint32_t *fieldnos;
+	uint32_t part_count;
+	/** Scratch array for key_hash_tuple(). */
+	const char **fields;
+	uint32_t field_count;
+	uint32_t partition_count;
+	/** Zero based partition number of each tuple. */
+	uint32_t *result;
+};
+
+static void
+hash_partition(struct hash_partition_task *task)
+{
+	const char *p = task->tuples;
+	for (uint32_t i = 0; i < task->tuple_count; ++i) {
+		uint64_t hash = key_hash_tuple(p, task->fieldnos,
+					       task->part_count, task->fields,
+					       task->field_count);
+		task->result[i] = hash % task->partition_count;
+		mp_next(&p);
+	}
+}
+
+/**
+ * Calculate partitions in a coio thread.
+ *
+ * It only reads msgpack, which is anchored by the waiting
+ * fiber.
+ */
+static ssize_t
+hash_partition_f(va_list ap)
+{
+	struct hash_partition_task *task =
+		va_arg(ap, struct hash_partition_task *);
+	hash_partition(task);
+	return 0;
+}
+
+/**
+ * Split a msgpack array of tuples into partitions by hashes of
+ * keys.
+ *
+ * The hash is the same as one used by the Bloom filter and does
+ * not depend on a platform, so tuples with equal keys fall into
+ * the same partition on any instance.
+ *
+ * Key fields are read from msgpack directly: tuples are not
+ * created and not validated. JSON paths are not supported.
+ *
+ * Options:
+ *
+ * - async: calculate in a coio thread. The fiber waits for the
+ *   result without blocking the event loop.
+ *
+ * Push a table of one based partition numbers of the tuples to
+ * a Lua stack on success. Raise error otherwise.
+ */
+static int
+lbox_key_def_hash_partition(struct lua_State *L)
+{
+	box_key_def_t *key_def;
+	int top = lua_gettop(L);
+	if (top < 3 || top > 4 ||
+	    (key_def = luaT_check_key_def(L, 1)) == NULL ||
+	    lua_type(L, 2) != LUA_TSTRING ||
+	    lua_type(L, 3) != LUA_TNUMBER ||
+	    (! lua_isnoneornil(L, 4) && ! lua_istable(L, 4))) {
+		return luaL_error(L, "Usage: key_def:hash_partition(data, "
+				  "partition_count[, {async = <boolean>}])");
+	}
+	lua_settop(L, 4);
+
+	double partition_count = lua_tonumber(L, 3);
+	if (! (partition_count >= 1 && partition_count <= UINT32_MAX) ||
+	    partition_count != floor(partition_count)) {
+		diag_set(ER_ILLEGAL_PARAMS, "partition_count must be a "
+			 "positive integer");
+		return luaT_error(L);
+	}
+	bool async = luaT_opts_bool(L, 4, "async");
+	if (key_def_check_hashable(key_def) != 0)
+		return luaT_error(L);
+
+	struct hash_partition_task task;
+	task.partition_count = (uint32_t)partition_count;
+	size_t len;
+	const char *data = lua_tolstring(L, 2, &len);
+	if (mp_decode_batch(data, len, &task.tuples, &task.tuple_count) != 0)
+		return luaT_error(L);
+
+	lua_createtable(L, task.tuple_count, 0);
+
+	size_t region_svp = box_region_used();
+	box_key_part_def_t *parts = box_key_def_dump_parts(key_def,
+							   &task.part_count);
+	if (parts == NULL) {
+		box_region_truncate(region_svp);
+		return luaT_error(L);
+	}
+	size_t fieldnos_size = sizeof(uint32_t) * task.part_count;
+	uint32_t *fieldnos = box_region_aligned_alloc(fieldnos_size,
+						      alignof(uint32_t));
+	if (fieldnos == NULL) {
+		box_region_truncate(region_svp);
+		diag_set(ER_MEMORY_ISSUE, (unsigned)fieldnos_size,
+			 "box_region_aligned_alloc", "fieldnos");
+		return luaT_error(L);
+	}
+	task.field_count = 0;
+	for (uint32_t i = 0; i < task.part_count; ++i) {
+		if (JSON_PATH(&parts[i]) != NULL) {
+			box_region_truncate(region_svp);
+			diag_set(ER_ILLEGAL_PARAMS, "JSON path is not "
+				 "supported by hash_partition()");
+			return luaT_error(L);
+		}
+		fieldnos[i] = parts[i].fieldno;
+		if (fieldnos[i] >= task.field_count)
+			task.field_count = fieldnos[i] + 1;
+	}
+	task.fieldnos = fieldnos;
+
+	size_t fields_size = sizeof(const char *) * task.field_count;
+	task.fields = box_region_aligned_alloc(fields_size,
+					       alignof(const char *));
+	size_t result_size = sizeof(uint32_t) * task.tuple_count;
+	task.result = box_region_aligned_alloc(result_size,
+					       alignof(uint32_t));
+	if (task.fields == NULL ||
+	    (task.result == NULL && task.tuple_count > 0)) {
+		box_region_truncate(region_svp);
+		diag_set(ER_MEMORY_ISSUE, (unsigned)result_size,
+			 "box_region_aligned_alloc", "result");
+		return luaT_error(L);
+	}
+
+	if (async) {
+		if (coio_call(hash_partition_f, &task) != 0) {
+			box_region_truncate(region_svp);
+			diag_set(ER_PROC_C, "Failed to run a coio task: %s",
+				 strerror(errno));
+			return luaT_error(L);
+		}
+	} else {
+		hash_partition(&task);
+	}
+
+	for (uint32_t i = 0; i < task.tuple_count; ++i) {
+		lua_pushinteger(L, task.result[i] + 1);
+		lua_rawseti(L, -2, i + 1);
+	}
+	box_region_truncate(region_svp);
+	return 1;
+}
+
+/* }}} Raw msgpack batches */
+
+/* {{{ Quantiles */
+
+/** Default size of a sample for key_def:quantiles(). */
+enum { QUANTILES_SAMPLE_DEFAULT = 1000 };
+
+/**
+ * Compare tuple pointers using a key definition passed as
+ * @a arg.
+ */
+static int
+tuple_ptr_cmp(const void *a, const void *b, void *arg)
+{
+	box_tuple_t *tuple_a = *(box_tuple_t * const *)a;
+	box_tuple_t *tuple_b = *(box_tuple_t * const *)b;
+	return box_tuple_compare(tuple_a, tuple_b, arg);
+}
+
+/**
+ * Estimate keys, which split given tuples into @a n parts of
+ * approximately equal size.
+ *
+ * A uniform sample of tuples is collected in one pass using
+ * reservoir sampling, so an iterator of any length may be
+ * passed: memory consumption depends only on the sample size.
+ * Only sampled values are converted to tuples.
+ *
+ * The sample is sorted and n - 1 boundary keys are taken at
+ * equal distances. The keys may repeat, when the data is
+ * skewed.
+ *
+ * Options:
+ *
+ * - sample: size of the sample, 1000 by default;
+ * - seed: seed of the random generator, a random one is used
+ *   by default;
+ * - msgpack: push keys as msgpack strings instead of tuples;
+ * - yield_every, yield_interval: see luaT_tuple_source_create().
+ *
+ * Push a table of the boundary keys to a Lua stack on success.
+ * Raise error otherwise.
+ */
+static int
+lbox_key_def_quantiles(struct lua_State *L)
+{
+	box_key_def_t *key_def;
+	int top = lua_gettop(L);
+	if (top < 3 || top > 4 ||
+	    (key_def = luaT_check_key_def(L, 1)) == NULL ||
+	    lua_type(L, 3) != LUA_TNUMBER ||
+	    (! lua_isnoneornil(L, 4) && ! lua_istable(L, 4))) {
+		return luaL_error(L, "Usage: key_def:quantiles(tuples, n"
+				  "[, {sample = <number>, seed = <number>, "
+				  "msgpack = <boolean>}])");
+	}
+	lua_settop(L, 4);
+
+	double n_arg = lua_tonumber(L, 3);
+	if (! (n_arg >= 1 && n_arg <= UINT32_MAX) || n_arg != floor(n_arg)) {
+		diag_set(ER_ILLEGAL_PARAMS, "n must be a positive integer");
+		return luaT_error(L);
+	}
+	uint32_t n = (uint32_t)n_arg;
+	double sample_max;
+	double seed;
+	if (luaT_opts_number(L, 4, "sample", QUANTILES_SAMPLE_DEFAULT,
+			     &sample_max) != 0 ||
+	    luaT_opts_number(L, 4, "seed", 0, &seed) != 0)
+		return luaT_error(L);
+	if (! (sample_max >= 1 && sample_max <= INT32_MAX) ||
+	    sample_max != floor(sample_max)) {
+		diag_set(ER_ILLEGAL_PARAMS, "sample must be a positive "
+			 "integer");
+		return luaT_error(L);
+	}
+	if (seed == 0)
+		seed = fiber_time() * 1e6;
+	uint64_t seed_bits;
+	memcpy(&seed_bits, &seed, sizeof(seed_bits));
+	uint64_t random_state = key_hash_fmix(seed_bits) | 1;
+	bool push_msgpack = luaT_opts_bool(L, 4, "msgpack");
+
+	struct tuple_source source;
+	if (luaT_tuple_source_create(L, 2, 4, &source) != 0)
+		return luaT_error(L);
+
+	/*
+	 * The sample is kept in a Lua table: it anchors the
+	 * tuples, so they don't leak at an error raised by an
+	 * iterator.
+	 */
+	lua_newtable(L);
+	int sample_idx = lua_gettop(L);
+	uint32_t sample_size = 0;
+	uint64_t seen = 0;
+	while (luaT_tuple_source_next(L, &source)) {
+		uint64_t slot = seen;
+		if (seen >= sample_max)
+			slot = xorshift64star(&random_state) % (seen + 1);
+		++seen;
+		if (slot >= sample_max) {
+			lua_pop(L, 1);
+			continue;
+		}
+		struct tuple *tuple = luaT_key_def_check_tuple(L, key_def,
+							       lua_gettop(L));
+		if (tuple == NULL)
+			return luaT_error(L);
+		luaT_pushtuple(L, tuple);
+		box_tuple_unref(tuple);
+		lua_rawseti(L, sample_idx, slot + 1);
+		lua_pop(L, 1);
+		if (slot >= sample_size)
+			sample_size = slot + 1;
+	}
+
+	size_t region_svp = box_region_used();
+	size_t size = sizeof(box_tuple_t *) * sample_size;
+	box_tuple_t **tuples = box_region_aligned_alloc(
+		size, alignof(box_tuple_t *));
+	if (tuples == NULL && sample_size > 0) {
+		diag_set(ER_MEMORY_ISSUE, (unsigned)size,
+			 "box_region_aligned_alloc", "tuples");
+		return luaT_error(L);
+	}
+	for (uint32_t i = 0; i < sample_size; ++i) {
+		lua_rawgeti(L, sample_idx, i + 1);
+		tuples[i] = luaT_istuple(L, -1);
+		assert(tuples[i] != NULL);
+		lua_pop(L, 1);
+	}
+	qsort_arg(tuples, sample_size, sizeof(box_tuple_t *), tuple_ptr_cmp,
+		  key_def);
+
+	lua_createtable(L, n - 1, 0);
+	for (uint32_t q = 1; q < n && sample_size > 0; ++q) {
+		uint32_t i = (uint64_t)q * sample_size / n;
+		size_t key_svp = box_region_used();
+		uint32_t key_size;
+		const char *key = box_key_def_extract_key(
+			key_def, tuples[i], KEY_DEF_MULTIKEY_NONE, &key_size);
+		if (key == NULL) {
+			box_region_truncate(region_svp);
+			return luaT_error(L);
+		}
+		if (push_msgpack) {
+			lua_pushlstring(L, key, key_size);
+		} else {
+			struct tuple *ret = box_tuple_new(
+				box_tuple_format_default(), key,
+				key + key_size);
+			if (ret == NULL) {
+				box_region_truncate(region_svp);
+				return luaT_error(L);
+			}
+			luaT_pushtuple(L, ret);
+		}
+		box_region_truncate(key_svp);
+		lua_rawseti(L, -2, q);
+	}
+	box_region_truncate(region_svp);
+	return 1;
+}
+
+/* }}} Quantiles */
+
+/* {{{ Merge join */
+
+enum join_mode {
+	/** Emit matched pairs only. */
+	JOIN_INNER,
+	/** Emit also left tuples without a match. */
+	JOIN_LEFT,
+	join_mode_MAX,
+};
+
+static const char *const join_mode_strs[] = {
+	"inner",
+	"left",
+};
+
+/**
+ * Create a key definition to compare tuples of the left side of
+ * a join with keys of the right side.
+ *
+ * Parts of @a left and @a right must pairwise have the same
+ * types and collations. The result has parts of @a left, which
+ * are nullable if either of the corresponding parts is nullable.
+ *
+ * Return NULL and set a diag at a failure.
+ */
+static box_key_def_t *
+key_def_new_join(const box_key_def_t *left, const box_key_def_t *right)
+{
+	size_t region_svp = box_region_used();
+	box_key_def_t *res = NULL;
+	uint32_t left_count = 0;
+	uint32_t right_count = 0;
+	box_key_part_def_t *left_parts = box_key_def_dump_parts(left,
+								&left_count);
+	if (left_parts == NULL)
+		goto out;
+	box_key_part_def_t *right_parts = box_key_def_dump_parts(right,
+								 &right_count);
+	if (right_parts == NULL)
+		goto out;
+	if (left_count != right_count) {
+		diag_set(ER_ILLEGAL_PARAMS, "Join key definitions have "
+			 "different part count: %u and %u",
+			 (unsigned)left_count, (unsigned)right_count);
+		goto out;
+	}
+	for (uint32_t i = 0; i < left_count; ++i) {
+		box_key_part_def_t *l = &left_parts[i];
+		box_key_part_def_t *r = &right_parts[i];
+		if (strcmp(l->field_type, r->field_type) != 0) {
+			diag_set(ER_ILLEGAL_PARAMS, "Join key part %u has "
+				 "different types: %s and %s",
+				 (unsigned)(i + TUPLE_INDEX_BASE),
+				 l->field_type, r->field_type);
+			goto out;
+		}
+		const char *l_coll = l->collation != NULL ? l->collation : "";
+		const char *r_coll = r->collation != NULL ? r->collation : "";
+		if (strcmp(l_coll, r_coll) != 0) {
+			diag_set(ER_ILLEGAL_PARAMS, "Join key part %u has "
+				 "different collations",
+				 (unsigned)(i + TUPLE_INDEX_BASE));
+			goto out;
+		}
+		l->flags |= r->flags & BOX_KEY_PART_DEF_IS_NULLABLE;
+	}
+	res = box_key_def_new_v2(left_parts, left_count);
+out:
+	box_region_truncate(region_svp);
+	return res;
+}
+
+/**
+ * Copy a key of a right side tuple into the buffer, which is a
+ * userdata at @a buf_idx of the Lua stack. The buffer is grown
+ * when necessary, so keys are not allocated per tuple.
+ *
+ * Return the key on success, otherwise return NULL and set a
+ * diag.
+ */
+static const char *
+luaT_join_copy_key(struct lua_State *L, box_key_def_t *key_def,
+		   box_tuple_t *tuple, int buf_idx, size_t *capacity)
+{
+	size_t region_svp = box_region_used();
+	uint32_t key_size;
+	const char *key = box_key_def_extract_key(key_def, tuple,
+						  KEY_DEF_MULTIKEY_NONE,
+						  &key_size);
+	if (key == NULL) {
+		box_region_truncate(region_svp);
+		return NULL;
+	}
+	char *buf = lua_touserdata(L, buf_idx);
+	if (key_size > *capacity) {
+		*capacity = key_size * 2;
+		buf = lua_newuserdata(L, *capacity);
+		lua_replace(L, buf_idx);
+	}
+	memcpy(buf, key, key_size);
+	box_region_truncate(region_svp);
+	return buf;
+}
+
+/**
+ * Append {left, right} pair to the result table. @a right_idx is
+ * zero for an unmatched left tuple: {left} is appended then.
+ */
+static void
+luaT_join_emit(struct lua_State *L, int res_idx, uint32_t *res_count,
+	       int left_idx, int right_idx)
+{
+	lua_createtable(L, 2, 0);
+	lua_pushvalue(L, left_idx);
+	lua_rawseti(L, -2, 1);
+	if (right_idx != 0) {
+		lua_pushvalue(L, right_idx);
+		lua_rawseti(L, -2, 2);
+	}
+	lua_rawseti(L, res_idx, ++*res_count);
+}
+
+/**
+ * Merge join of two inputs sorted by their key definitions.
+ *
+ * The key definitions may point to different fields, but their
+ * parts must pairwise have the same types and collations. Left
+ * tuples are compared with keys of right tuples directly. A key
+ * of each right tuple is extracted once into a reusable buffer.
+ *
+ * Keys are compared in the same way as in an index, so nil
+ * matches nil. The order of each input is verified on the fly:
+ * equal keys are allowed.
+ *
+ * Options:
+ *
+ * - mode: 'inner' (default) or 'left' (left outer join);
+ * - yield_every, yield_interval: see luaT_tuple_source_create().
+ *   The options are applied to each input.
+ *
+ * Push a table of {left, right} tuple pairs to a Lua stack on
+ * success. An unmatched left tuple is pushed as {left} in the
+ * left outer mode. Raise error otherwise.
+ */
+static int
+lbox_key_def_join(struct lua_State *L)
+{
+	box_key_def_t *left_kd, *right_kd;
+	int top = lua_gettop(L);
+	if (top < 4 || top > 5 ||
+	    (left_kd = luaT_check_key_def(L, 1)) == NULL ||
+	    (right_kd = luaT_check_key_def(L, 2)) == NULL ||
+	    (! lua_isnoneornil(L, 5) && ! lua_istable(L, 5))) {
+		return luaL_error(L, "Usage: key_def:join(right_key_def, "
+				  "left, right[, {mode = 'inner' | 'left'}])");
+	}
+	lua_settop(L, 5);
+
+	enum join_mode mode = JOIN_INNER;
+	if (! lua_isnil(L, 5)) {
+		lua_getfield(L, 5, "mode");
+		if (lua_type(L, -1) == LUA_TSTRING) {
+			size_t len;
+			const char *name = lua_tolstring(L, -1, &len);
+			mode = strnindex(join_mode_strs, name, len,
+					 join_mode_MAX);
+		} else if (! lua_isnil(L, -1)) {
+			mode = join_mode_MAX;
+		}
+		lua_pop(L, 1);
+	}
+	if (mode == join_mode_MAX) {
+		diag_set(ER_ILLEGAL_PARAMS, "mode must be 'inner' or 'left'");
+		return luaT_error(L);
+	}
+
+	box_key_def_t *join_kd = key_def_new_join(left_kd, right_kd);
+	if (join_kd == NULL)
+		return luaT_error(L);
+	*(box_key_def_t **) luaL_pushcdata(L, CTID_STRUCT_TUPLE_KEY_DEF_REF) =
+		join_kd;
+	lua_pushcfunction(L, lbox_key_def_gc);
+	luaL_setcdatagc(L, -2);
+
+	struct tuple_source left_source, right_source;
+	if (luaT_tuple_source_create(L, 3, 5, &left_source) != 0 ||
+	    luaT_tuple_source_create(L, 4, 5, &right_source) != 0)
+		return luaT_error(L);
+
+	size_t key_capacity = 64;
+	lua_newuserdata(L, key_capacity);
+	int key_idx = lua_gettop(L);
+	/* Current left tuple, current right tuple, right group. */
+	lua_pushnil(L);
+	int left_idx = lua_gettop(L);
+	lua_pushnil(L);
+	int right_idx = lua_gettop(L);
+	lua_pushnil(L);
+	int group_idx = lua_gettop(L);
+	/* Previous left and right tuples to verify the order. */
+	lua_pushnil(L);
+	int left_prev_idx = lua_gettop(L);
+	lua_pushnil(L);
+	int right_prev_idx = lua_gettop(L);
+	lua_newtable(L);
+	int res_idx = lua_gettop(L);
+	uint32_t res_count = 0;
+
+	box_tuple_t *left = NULL;
+	box_tuple_t *right = NULL;
+	const char *key = NULL;
+	int left_rc = luaT_tuple_source_next_sorted(
+		L, &left_source, left_kd, left_idx, left_prev_idx, "left",
+		false, &left);
+	if (left_rc < 0)
+		return luaT_error(L);
+	int right_rc = luaT_tuple_source_next_sorted(
+		L, &right_source, right_kd, right_idx, right_prev_idx,
+		"right", false, &right);
+	if (right_rc < 0)
+		return luaT_error(L);
+	if (right_rc > 0 && (key = luaT_join_copy_key(
+			L, right_kd, right, key_idx, &key_capacity)) == NULL)
+		return luaT_error(L);
+
+	while (left_rc > 0) {
+		/* Nothing to match the rest of the left input with. */
+		if (right_rc == 0 && mode == JOIN_INNER)
+			break;
+		int cmp = right_rc > 0 ?
+			  box_tuple_compare_with_key(left, key, join_kd) : -1;
+		if (cmp < 0) {
+			if (mode == JOIN_LEFT)
+				luaT_join_emit(L, res_idx, &res_count,
+					       left_idx, 0);
+			left_rc = luaT_tuple_source_next_sorted(
+				L, &left_source, left_kd, left_idx,
+				left_prev_idx, "left", false, &left);
+			if (left_rc < 0)
+				return luaT_error(L);
+			continue;
+		}
+		if (cmp > 0) {
+			right_rc = luaT_tuple_source_next_sorted(
+				L, &right_source, right_kd, right_idx,
+				right_prev_idx, "right", false, &right);
+			if (right_rc < 0)
+				return luaT_error(L);
+			if (right_rc > 0 && (key = luaT_join_copy_key(
+					L, right_kd, right, key_idx,
+					&key_capacity)) == NULL)
+				return luaT_error(L);
+			continue;
+		}
+
+		/* Collect right tuples with the same key. */
+		lua_createtable(L, 1, 0);
+		lua_pushvalue(L, right_idx);
+		lua_rawseti(L, -2, 1);
+		lua_replace(L, group_idx);
+		uint32_t group_size = 1;
+		box_tuple_t *group_first = right;
+		while ((right_rc = luaT_tuple_source_next_sorted(
+				L, &right_source, right_kd, right_idx,
+				right_prev_idx, "right", false,
+				&right)) > 0 &&
+		       box_tuple_compare(right, group_first, right_kd) == 0) {
+			lua_pushvalue(L, right_idx);
+			lua_rawseti(L, group_idx, ++group_size);
+		}
+		if (right_rc < 0)
+			return luaT_error(L);
+
+		/* The buffer still holds the key of the group. */
+		do {
+			for (uint32_t i = 1; i <= group_size; ++i) {
+				lua_rawgeti(L, group_idx, i);
+				luaT_join_emit(L, res_idx, &res_count,
+					       left_idx, lua_gettop(L));
+				lua_pop(L, 1);
+			}
+			left_rc = luaT_tuple_source_next_sorted(
+				L, &left_source, left_kd, left_idx,
+				left_prev_idx, "left", false, &left);
+			if (left_rc < 0)
+				return luaT_error(L);
+		} while (left_rc > 0 &&
+			 box_tuple_compare_with_key(left, key, join_kd) == 0);
+
+		if (right_rc > 0 && (key = luaT_join_copy_key(
+				L, right_kd, right, key_idx,
+				&key_capacity)) == NULL)
+			return luaT_error(L);
+	}
+	lua_pushvalue(L, res_idx);
+	return 1;
+}
+
+/* }}} Merge join */
+
+/* {{{ Key blocks */
+
+/**
+ * Sorted keys of a key definition in prefix compressed blocks,
+ * see key_block.h.
+ */
+struct tuple_keydef_key_block {
+	/** Validates searched keys. */
+	box_key_def_t *key_def;
+	/** Compares tuples made of keys. */
+	box_key_def_t *cmp_def;
+	struct key_block_set set;
+};
+
+enum {
+	KEY_BLOCK_RESTART_INTERVAL_DEFAULT = 16,
+	KEY_BLOCK_SIZE_DEFAULT = 4096,
+};
+
+/**
+ * Create an empty key block set.
+ *
+ * Return NULL and set a diag at a failure.
+ */
+static struct tuple_keydef_key_block *
+tuple_keydef_key_block_new(const box_key_def_t *key_def,
+			   uint32_t restart_interval, uint32_t block_size)
+{
+	struct tuple_keydef_key_block *block = malloc(sizeof(*block));
+	if (block == NULL) {
+		diag_set(ER_MEMORY_ISSUE, (unsigned)sizeof(*block), "malloc",
+			 "key block");
+		return NULL;
+	}
+	block->key_def = key_def_dup(key_def);
+	if (block->key_def == NULL) {
+		free(block);
+		return NULL;
+	}
+	block->cmp_def = key_def_new_for_keys(key_def);
+	if (block->cmp_def == NULL) {
+		box_key_def_delete(block->key_def);
+		free(block);
+		return NULL;
+	}
+	key_block_set_create(&block->set, restart_interval, block_size);
+	return block;
+}
+
+static void
+tuple_keydef_key_block_delete(struct tuple_keydef_key_block *block)
+{
+	key_block_set_destroy(&block->set);
+	box_key_def_delete(block->cmp_def);
+	box_key_def_delete(block->key_def);
+	free(block);
+}
+
+static struct tuple_keydef_key_block *
+luaT_check_key_block(struct lua_State *L, int idx)
+{
+	if (! luaL_iscdata(L, idx))
+		return NULL;
+
+	uint32_t cdata_type;
+	struct tuple_keydef_key_block **block_ptr =
+		luaL_checkcdata(L, idx, &cdata_type);
+	if (block_ptr == NULL ||
+	    cdata_type != CTID_STRUCT_TUPLE_KEYDEF_KEY_BLOCK_REF)
+		return NULL;
+	return *block_ptr;
+}
+
+/**
+ * Free a key block set from a Lua code.
+ */
+static int
+lbox_key_block_gc(struct lua_State *L)
+{
+	struct tuple_keydef_key_block *block = luaT_check_key_block(L, 1);
+	assert(block != NULL);
+	tuple_keydef_key_block_delete(block);
+	return 0;
+}
+
+static void
+luaT_push_key_block(struct lua_State *L, struct tuple_keydef_key_block *block)
+{
+	*(struct tuple_keydef_key_block **)
+		luaL_pushcdata(L, CTID_STRUCT_TUPLE_KEYDEF_KEY_BLOCK_REF) =
+		block;
+	lua_pushcfunction(L, lbox_key_block_gc);
+	luaL_setcdatagc(L, -2);
+}
+
+/**
+ * Extract a key of a tuple and append it to a key block set.
+ *
+ * Return 0 on success, otherwise return -1 and set a diag.
+ */
+static int
+key_block_add_tuple(struct tuple_keydef_key_block *block, box_tuple_t *tuple)
+{
+	size_t region_svp = box_region_used();
+	uint32_t key_size;
+	const char *key = box_key_def_extract_key(block->key_def, tuple,
+						  KEY_DEF_MULTIKEY_NONE,
+						  &key_size);
+	int rc = -1;
+	if (key == NULL)
+		goto out;
+	if (key_block_set_add(&block->set, key, key_size) != 0) {
+		diag_set(ER_MEMORY_ISSUE, key_size, "realloc", "key block");
+		goto out;
+	}
+	rc = 0;
+out:
+	box_region_truncate(region_svp);
+	return rc;
+}
+
+/**
+ * Build a set of keys of given tuples stored in prefix
+ * compressed blocks.
+ *
+ * The tuples are sorted by the key definition first. Keys are
+ * not deduplicated.
+ *
+ * Options:
+ *
+ * - restart_interval: store each this number of keys in full,
+ *   16 by default;
+ * - block_size: target size of a block in bytes, 4096 by
+ *   default;
+ * - sorted: the input is already sorted, so it is not collected
+ *   and sorted, but the order is verified;
+ * - yield_every, yield_interval: see luaT_tuple_source_create().
+ *   The options cover reading of the input: the sorting of the
+ *   collected tuples does not yield.
+ *
+ * Push the new key block set as cdata to a Lua stack on success.
+ * Raise error otherwise.
+ */
+static int
+lbox_key_def_key_block(struct lua_State *L)
+{
+	box_key_def_t *key_def;
+	int top = lua_gettop(L);
+	if (top < 2 || top > 3 ||
+	    (key_def = luaT_check_key_def(L, 1)) == NULL ||
+	    (! lua_isnoneornil(L, 3) && ! lua_istable(L, 3))) {
+		return luaL_error(L, "Usage: key_def:key_block(tuples"
+				  "[, {restart_interval = <number>, "
+				  "block_size = <number>, "
+				  "sorted = <boolean>}])");
+	}
+	lua_settop(L, 3);
+
+	double restart_interval;
+	double block_size;
+	if (luaT_opts_number(L, 3, "restart_interval",
+			     KEY_BLOCK_RESTART_INTERVAL_DEFAULT,
+			     &restart_interval) != 0 ||
+	    luaT_opts_number(L, 3, "block_size", KEY_BLOCK_SIZE_DEFAULT,
+			     &block_size) != 0)
+		return luaT_error(L);
+	if (! (restart_interval >= 1 && restart_interval <= UINT32_MAX) ||
+	    restart_interval != floor(restart_interval)) {
+		diag_set(ER_ILLEGAL_PARAMS, "restart_interval must be a "
+			 "positive integer");
+		return luaT_error(L);
+	}
+	if (! (block_size >= 1 && block_size <= UINT32_MAX) ||
+	    block_size != floor(block_size)) {
+		diag_set(ER_ILLEGAL_PARAMS, "block_size must be a positive "
+			 "integer");
+		return luaT_error(L);
+	}
+	bool sorted = luaT_opts_bool(L, 3, "sorted");
+
+	struct tuple_source source;
+	if (luaT_tuple_source_create(L, 2, 3, &source) != 0)
+		return luaT_error(L);
+
+	/* Anchor the object: it is freed at an error. */
+	struct tuple_keydef_key_block *block = tuple_keydef_key_block_new(
+		key_def, restart_interval, block_size);
+	if (block == NULL)
+		return luaT_error(L);
+	luaT_push_key_block(L, block);
+	int block_idx = lua_gettop(L);
+
+	if (sorted) {
+		/* The previous tuple. */
+		lua_pushnil(L);
+		int prev_idx = lua_gettop(L);
+		box_tuple_t *prev = NULL;
+		while (luaT_tuple_source_next(L, &source)) {
+			box_tuple_t *tuple = luaT_key_def_check_tuple(
+				L, key_def, lua_gettop(L));
+			if (tuple == NULL)
+				return luaT_error(L);
+			if (prev != NULL &&
+			    box_tuple_compare(prev, tuple, key_def) > 0) {
+				box_tuple_unref(tuple);
+				diag_set(ER_ILLEGAL_PARAMS, "Tuples are not "
+					 "sorted: see tuple %u",
+					 (unsigned)source.count);
+				return luaT_error(L);
+			}
+			lua_pop(L, 1);
+			luaT_pushtuple(L, tuple);
+			box_tuple_unref(tuple);
+			lua_replace(L, prev_idx);
+			prev = tuple;
+			if (key_block_add_tuple(block, tuple) != 0)
+				return luaT_error(L);
+		}
+	} else {
+		/* The table anchors the tuples till the end. */
+		lua_newtable(L);
+		int tuples_idx = lua_gettop(L);
+		while (luaT_tuple_source_next(L, &source)) {
+			box_tuple_t *tuple = luaT_key_def_check_tuple(
+				L, key_def, lua_gettop(L));
+			if (tuple == NULL)
+				return luaT_error(L);
+			luaT_pushtuple(L, tuple);
+			box_tuple_unref(tuple);
+			lua_rawseti(L, tuples_idx, source.count);
+			lua_pop(L, 1);
+		}
+		uint32_t count = source.count;
+		box_tuple_t **tuples = lua_newuserdata(
+			L, count * sizeof(box_tuple_t *));
+		for (uint32_t i = 0; i < count; ++i) {
+			lua_rawgeti(L, tuples_idx, i + 1);
+			tuples[i] = luaT_istuple(L, -1);
+			assert(tuples[i] != NULL);
+			lua_pop(L, 1);
+		}
+		qsort_arg(tuples, count, sizeof(box_tuple_t *),
+			  tuple_ptr_cmp, key_def);
+		for (uint32_t i = 0; i < count; ++i) {
+			if (key_block_add_tuple(block, tuples[i]) != 0)
+				return luaT_error(L);
+		}
+	}
+	if (key_block_set_finish(&block->set) != 0) {
+		diag_set(ER_MEMORY_ISSUE, block->set.block_size, "malloc",
+			 "key block");
+		return luaT_error(L);
+	}
+	lua_pushvalue(L, block_idx);
+	return 1;
+}
+
+/**
+ * Find the first key, which is not less than a (partial) key at
+ * @a idx of the Lua stack.
+ *
+ * Set @a pos to its zero based position and @a is_found to
+ * whether it is equal to the searched key.
+ *
+ * Return 0 on success, otherwise return -1 and set a diag.
+ */
+static int
+luaT_key_block_search(struct lua_State *L,
+		      struct tuple_keydef_key_block *block, int idx,
+		      uint32_t *pos, bool *is_found)
+{
+	const struct key_block_set *set = &block->set;
+	size_t region_svp = box_region_used();
+	struct key_search search;
+	if (luaT_key_search_create(L, idx, block->key_def, block->cmp_def,
+				   &search) != 0) {
+		box_region_truncate(region_svp);
+		return -1;
+	}
+	size_t size = set->key_size_max * 2 +
+		      mp_sizeof_array(search.part_count);
+	char *buf = box_region_alloc(size);
+	if (buf == NULL) {
+		diag_set(ER_MEMORY_ISSUE, (unsigned)size, "box_region_alloc",
+			 "buf");
+		key_search_destroy(&search);
+		box_region_truncate(region_svp);
+		return -1;
+	}
+	search.buf = buf + set->key_size_max;
+
+	*pos = key_block_set_lower_bound(set, key_search_cmp, &search,
+					 buf);
+	*is_found = false;
+	if (*pos < set->key_count) {
+		uint32_t found_size = key_block_set_get(set, *pos, buf);
+		*is_found = key_search_cmp(buf, found_size, &search) == 0;
+	}
+	key_search_destroy(&search);
+	box_region_truncate(region_svp);
+	return 0;
+}
+
+/**
+ * Push the position of the first key, which is not less than
+ * a given (partial) key. len() + 1 is pushed, when all keys are
+ * less.
+ */
+static int
+lbox_key_block_lower_bound(struct lua_State *L)
+{
+	struct tuple_keydef_key_block *block;
+	if (lua_gettop(L) != 2 ||
+	    (block = luaT_check_key_block(L, 1)) == NULL)
+		return luaL_error(L, "Usage: key_block:lower_bound(key)");
+
+	uint32_t pos;
+	bool is_found;
+	if (luaT_key_block_search(L, block, 2, &pos, &is_found) != 0)
+		return luaT_error(L);
+	lua_pushinteger(L, pos + 1);
+	return 1;
+}
+
+/**
+ * Push the position of the first key, which is equal to a given
+ * (partial) key, or nil.
+ */
+static int
+lbox_key_block_find(struct lua_State *L)
+{
+	struct tuple_keydef_key_block *block;
+	if (lua_gettop(L) != 2 ||
+	    (block = luaT_check_key_block(L, 1)) == NULL)
+		return luaL_error(L, "Usage: key_block:find(key)");
+
+	uint32_t pos;
+	bool is_found;
+	if (luaT_key_block_search(L, block, 2, &pos, &is_found) != 0)
+		return luaT_error(L);
+	if (is_found)
+		lua_pushinteger(L, pos + 1);
+	else
+		lua_pushnil(L);
+	return 1;
+}
+
+/**
+ * Push a key at a given position as a tuple or nil, when the
+ * position is out of range.
+ */
+static int
+lbox_key_block_get(struct lua_State *L)
+{
+	struct tuple_keydef_key_block *block;
+	if (lua_gettop(L) != 2 ||
+	    (block = luaT_check_key_block(L, 1)) == NULL ||
+	    lua_type(L, 2) != LUA_TNUMBER)
+		return luaL_error(L, "Usage: key_block:get(position)");
+
+	const struct key_block_set *set = &block->set;
+	lua_Integer pos = lua_tointeger(L, 2);
+	if (pos < 1 || pos > set->key_count) {
+		lua_pushnil(L);
+		return 1;
+	}
+	size_t region_svp = box_region_used();
+	char *buf = box_region_alloc(set->key_size_max);
+	if (buf == NULL) {
+		diag_set(ER_MEMORY_ISSUE, set->key_size_max,
+			 "box_region_alloc", "buf");
+		return luaT_error(L);
+	}
+	uint32_t key_size = key_block_set_get(set, pos - 1, buf);
+	box_tuple_t *key = box_tuple_new(box_tuple_format_default(), buf,
+					 buf + key_size);
+	box_region_truncate(region_svp);
+	if (key == NULL)
+		return luaT_error(L);
+	luaT_pushtuple(L, key);
+	return 1;
+}
+
+/**
+ * Push the number of keys.
+ */
+static int
+lbox_key_block_len(struct lua_State *L)
+{
+	struct tuple_keydef_key_block *block;
+	/* The __len metamethod passes an extra argument. */
+	if (lua_gettop(L) < 1 ||
+	    (block = luaT_check_key_block(L, 1)) == NULL)
+		return luaL_error(L, "Usage: key_block:len()");
+
+	lua_pushinteger(L, block->set.key_count);
+	return 1;
+}
+
+/**
+ * Push the average number of bytes occupied by a key including
+ * the blocks overhead.
+ */
+static int
+lbox_key_block_bytes_per_key(struct lua_State *L)
+{
+	struct tuple_keydef_key_block *block;
+	if (lua_gettop(L) != 1 ||
+	    (block = luaT_check_key_block(L, 1)) == NULL)
+		return luaL_error(L, "Usage: key_block:bytes_per_key()");
+
+	const struct key_block_set *set = &block->set;
+	lua_pushnumber(L, set->key_count == 0 ? 0 :
+		       (double)set->memory / set->key_count);
+	return 1;
+}
+
+/* }}} Key blocks */
+
+/* {{{ Diff */
+
+/**
+ * Whether two tuples have the same msgpack payload.
+ */
+static bool
+tuple_payload_is_equal(box_tuple_t *a, box_tuple_t *b)
+{
+	uint32_t field_count = box_tuple_field_count(a);
+	if (box_tuple_field_count(b) != field_count)
+		return false;
+	if (field_count == 0)
+		return true;
+	const char *a_begin = box_tuple_field(a, 0);
+	const char *b_begin = box_tuple_field(b, 0);
+	const char *a_end = box_tuple_field(a, field_count - 1);
+	const char *b_end = box_tuple_field(b, field_count - 1);
+	mp_next(&a_end);
+	mp_next(&b_end);
+	return a_end - a_begin == b_end - b_begin &&
+	       memcmp(a_begin, b_begin, a_end - a_begin) == 0;
+}
+
+enum diff_kind {
+	DIFF_INSERTED,
+	DIFF_DELETED,
+	DIFF_CHANGED,
+	diff_kind_MAX,
+};
+
+static const char *diff_kind_strs[] = {
+	"inserted",
+	"deleted",
+	"changed",
+};
+
+/**
+ * Report a difference: call the callback at @a callback_idx or
+ * append to the result table at @a res_idx otherwise.
+ *
+ * A tuple index is zero, when there is no such tuple for the
+ * kind of the difference.
+ */
+static void
+luaT_diff_emit(struct lua_State *L, int callback_idx, int res_idx,
+	       enum diff_kind kind, int old_idx, int new_idx)
+{
+	if (callback_idx != 0) {
+		lua_pushvalue(L, callback_idx);
+		lua_pushstring(L, diff_kind_strs[kind]);
+		if (old_idx != 0)
+			lua_pushvalue(L, old_idx);
+		else
+			lua_pushnil(L);
+		if (new_idx != 0)
+			lua_pushvalue(L, new_idx);
+		else
+			lua_pushnil(L);
+		lua_call(L, 3, 0);
+		return;
+	}
+	lua_getfield(L, res_idx, diff_kind_strs[kind]);
+	if (kind == DIFF_CHANGED) {
+		lua_createtable(L, 2, 0);
+		lua_pushvalue(L, old_idx);
+		lua_rawseti(L, -2, 1);
+		lua_pushvalue(L, new_idx);
+		lua_rawseti(L, -2, 2);
+	} else {
+		lua_pushvalue(L, old_idx != 0 ? old_idx : new_idx);
+	}
+	lua_rawseti(L, -2, lua_objlen(L, -2) + 1);
+	lua_pop(L, 1);
+}
+
+/**
+ * Find the difference between two inputs sorted by the key
+ * definition: say, an old snapshot and a fresh data.
+ *
+ * Both inputs are walked once. Tuples with the same key are
+ * compared by their msgpack payload, so a change of a field
+ * encoding (say, 1 and 1.0) is reported as a change. Keys must
+ * be unique within an input: the order is verified on the fly,
+ * so an error may be raised after some differences are passed
+ * to the callback.
+ *
+ * Options:
+ *
+ * - callback: a function(kind, old, new), which is called for
+ *   each difference instead of collecting it: kind is
+ *   'inserted' (old is nil), 'deleted' (new is nil) or
+ *   'changed';
+ * - yield_every, yield_interval: see luaT_tuple_source_create().
+ *   The options are applied to each input.
+ *
+ * Push {inserted = {new...}, deleted = {old...},
+ * changed = {{old, new}...}} table to a Lua stack on success.
+ * Push nothing, when the callback is given. Raise error
+ * otherwise.
+ */
+static int
+lbox_key_def_diff(struct lua_State *L)
+{
+	box_key_def_t *key_def;
+	int top = lua_gettop(L);
+	if (top < 3 || top > 4 ||
+	    (key_def = luaT_check_key_def(L, 1)) == NULL ||
+	    (! lua_isnoneornil(L, 4) && ! lua_istable(L, 4))) {
+		return luaL_error(L, "Usage: key_def:diff(old, new"
+				  "[, {callback = <function>}])");
+	}
+	lua_settop(L, 4);
+
+	int callback_idx = 0;
+	if (! lua_isnil(L, 4)) {
+		lua_getfield(L, 4, "callback");
+		if (lua_isfunction(L, -1)) {
+			callback_idx = lua_gettop(L);
+		} else if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+		} else {
+			diag_set(ER_ILLEGAL_PARAMS, "callback must be a "
+				 "function");
+			return luaT_error(L);
+		}
+	}
+
+	struct tuple_source old_source, new_source;
+	if (luaT_tuple_source_create(L, 2, 4, &old_source) != 0 ||
+	    luaT_tuple_source_create(L, 3, 4, &new_source) != 0)
+		return luaT_error(L);
+
+	int res_idx = 0;
+	if (callback_idx == 0) {
+		lua_createtable(L, 0, diff_kind_MAX);
+		for (int kind = 0; kind < diff_kind_MAX; ++kind) {
+			lua_newtable(L);
+			lua_setfield(L, -2, diff_kind_strs[kind]);
+		}
+		res_idx = lua_gettop(L);
+	}
+	lua_pushnil(L);
+	int old_idx = lua_gettop(L);
+	lua_pushnil(L);
+	int new_idx = lua_gettop(L);
+	lua_pushnil(L);
+	int old_prev_idx = lua_gettop(L);
+	lua_pushnil(L);
+	int new_prev_idx = lua_gettop(L);
+
+	box_tuple_t *old_tuple = NULL;
+	box_tuple_t *new_tuple = NULL;
+	int old_rc = luaT_tuple_source_next_sorted(
+		L, &old_source, key_def, old_idx, old_prev_idx, "old", true,
+		&old_tuple);
+	if (old_rc < 0)
+		return luaT_error(L);
+	int new_rc = luaT_tuple_source_next_sorted(
+		L, &new_source, key_def, new_idx, new_prev_idx, "new", true,
+		&new_tuple);
+	if (new_rc < 0)
+		return luaT_error(L);
+	while (old_rc > 0 || new_rc > 0) {
+		int cmp;
+		if (old_rc == 0)
+			cmp = 1;
+		else if (new_rc == 0)
+			cmp = -1;
+		else
+			cmp = box_tuple_compare(old_tuple, new_tuple, key_def);
+		if (cmp < 0) {
+			luaT_diff_emit(L, callback_idx, res_idx, DIFF_DELETED,
+				       old_idx, 0);
+		} else if (cmp > 0) {
+			luaT_diff_emit(L, callback_idx, res_idx, DIFF_INSERTED,
+				       0, new_idx);
+		} else if (! tuple_payload_is_equal(old_tuple, new_tuple)) {
+			luaT_diff_emit(L, callback_idx, res_idx, DIFF_CHANGED,
+				       old_idx, new_idx);
+		}
+		if (cmp <= 0) {
+			old_rc = luaT_tuple_source_next_sorted(
+				L, &old_source, key_def, old_idx,
+				old_prev_idx, "old", true, &old_tuple);
+			if (old_rc < 0)
+				return luaT_error(L);
+		}
+		if (cmp >= 0) {
+			new_rc = luaT_tuple_source_next_sorted(
+				L, &new_source, key_def, new_idx,
+				new_prev_idx, "new", true, &new_tuple);
+			if (new_rc < 0)
+				return luaT_error(L);
+		}
+	}
+	if (res_idx == 0)
+		return 0;
+	lua_pushvalue(L, res_idx);
+	return 1;
+}
+
+/* }}} Diff */
+
+/* {{{ Public API of the module */
 
 /**
  * Register the module.
@@ -668,6 +4311,22 @@ luaopen_tuple_keydef(struct lua_State *L)
 	luaL_cdef(L, "struct tuple_keydef;");
 	CTID_STRUCT_TUPLE_KEY_DEF_REF =
 		luaL_ctypeid(L, "struct tuple_keydef *");
+	/* Declared by the built-in buffer module. */
+	CTID_STRUCT_IBUF = luaL_ctypeid(L, "struct ibuf");
+	CTID_STRUCT_IBUF_REF = luaL_ctypeid(L, "struct ibuf *");
+
+	luaL_cdef(L, "struct tuple_keydef_bloom;");
+	CTID_STRUCT_TUPLE_KEYDEF_BLOOM_REF =
+		luaL_ctypeid(L, "struct tuple_keydef_bloom *");
+	luaL_cdef(L, "struct tuple_keydef_hll;");
+	CTID_STRUCT_TUPLE_KEYDEF_HLL_REF =
+		luaL_ctypeid(L, "struct tuple_keydef_hll *");
+	luaL_cdef(L, "struct tuple_keydef_key_block;");
+	CTID_STRUCT_TUPLE_KEYDEF_KEY_BLOCK_REF =
+		luaL_ctypeid(L, "struct tuple_keydef_key_block *");
+	luaL_cdef(L, "struct tuple_keydef_multikey;");
+	CTID_STRUCT_TUPLE_KEYDEF_MULTIKEY_REF =
+		luaL_ctypeid(L, "struct tuple_keydef_multikey *");
 
 	int rc = json_path_is_supported(&JSON_PATH_IS_SUPPORTED);
 	if (rc != 0)
@@ -677,15 +4336,54 @@ luaopen_tuple_keydef(struct lua_State *L)
 	static const struct luaL_Reg meta[] = {
 		{"new", lbox_key_def_new},
 		{"extract_key", lbox_key_def_extract_key},
+		{"extract_key_into", lbox_key_def_extract_key_into},
 		{"compare", lbox_key_def_compare},
 		{"compare_with_key", lbox_key_def_compare_with_key},
+		{"filter", lbox_key_def_filter},
 		{"merge", lbox_key_def_merge},
 		{"totable", lbox_key_def_to_table},
+		{"sort_permutation", lbox_key_def_sort_permutation},
+		{"hash_partition", lbox_key_def_hash_partition},
+		{"quantiles", lbox_key_def_quantiles},
+		{"join", lbox_key_def_join},
+		{"key_block", lbox_key_def_key_block},
+		{"diff", lbox_key_def_diff},
+		{"build_bloom", lbox_key_def_build_bloom},
+		{"deserialize_bloom", lbox_key_def_deserialize_bloom},
+		{"hll", lbox_key_def_hll},
+		{"deserialize_hll", lbox_key_def_deserialize_hll},
 		{NULL, NULL}
 	};
 	lua_createtable(L, 0, lengthof(meta) - 1);
 	luaL_register(L, NULL, meta);
 
+	/*
+	 * Methods of objects, which are created by the module.
+	 * They are set as ffi metatypes in the postload code.
+	 */
+	static const struct luaL_Reg internal[] = {
+		{"bloom_maybe_contains", lbox_bloom_maybe_contains},
+		{"bloom_maybe_contains_tuple", lbox_bloom_maybe_contains_tuple},
+		{"bloom_serialize", lbox_bloom_serialize},
+		{"hll_add", lbox_hll_add},
+		{"hll_add_many", lbox_hll_add_many},
+		{"hll_merge", lbox_hll_merge},
+		{"hll_estimate", lbox_hll_estimate},
+		{"hll_serialize", lbox_hll_serialize},
+		{"key_block_lower_bound", lbox_key_block_lower_bound},
+		{"key_block_find", lbox_key_block_find},
+		{"key_block_get", lbox_key_block_get},
+		{"key_block_len", lbox_key_block_len},
+		{"key_block_bytes_per_key", lbox_key_block_bytes_per_key},
+		{"multikey_extract_keys", lbox_multikey_extract_keys},
+		{"multikey_compare_with_key", lbox_multikey_compare_with_key},
+		{"multikey_totable", lbox_multikey_to_table},
+		{NULL, NULL}
+	};
+	lua_createtable(L, 0, lengthof(internal) - 1);
+	luaL_register(L, NULL, internal);
+	lua_setfield(L, -2, "internal");
+
 	lua_pushstring(L, TUPLE_KEYDEF_VERSION);
 	lua_setfield(L, -2, "_VERSION");
 
@@ -10,16 +10,141 @@
 -- The tuple.keydef module table is accessible as `...`.
 
 local ffi = require('ffi')
+local bit = require('bit')
 local tuple_keydef = ...
+local internal = tuple_keydef.internal
 local tuple_keydef_t = ffi.typeof('struct tuple_keydef')
+local tuple_keydef_bloom_t = ffi.typeof('struct tuple_keydef_bloom')
+local tuple_keydef_hll_t = ffi.typeof('struct tuple_keydef_hll')
+local tuple_keydef_key_block_t = ffi.typeof('struct tuple_keydef_key_block')
+local tuple_keydef_multikey_t = ffi.typeof('struct tuple_keydef_multikey')
+
+-- {{{ Key writer
+
+-- Size of a msgpack array header with 32 bit length.
+local ARRAY32_HEADER_SIZE = 5
+
+local extract_key_into = tuple_keydef.extract_key_into
+
+local key_writer_methods = {}
+local key_writer_mt = {__index = key_writer_methods}
+
+-- Append a key of the tuple to the buffer.
+--
+-- Returns the key size.
+function key_writer_methods.write(self, tuple)
+    local size = extract_key_into(self.keydef, tuple, self.ibuf)
+    self.count = self.count + 1
+    return size
+end
+
+-- Fix up the array header (if requested) and return the number
+-- of written keys.
+--
+-- The header is located relative to ibuf.rpos, so the buffer
+-- must not be consumed before the writer is finished.
+function key_writer_methods.finish(self)
+    if self.header_pos ~= nil then
+        local p = ffi.cast('uint8_t *', self.ibuf.rpos + self.header_pos)
+        local count = self.count
+        p[0] = 0xdd
+        p[1] = bit.band(bit.rshift(count, 24), 0xff)
+        p[2] = bit.band(bit.rshift(count, 16), 0xff)
+        p[3] = bit.band(bit.rshift(count, 8), 0xff)
+        p[4] = bit.band(count, 0xff)
+        self.header_pos = nil
+    end
+    return self.count
+end
+
+-- Create a streaming writer of msgpack keys into an ibuf.
+--
+-- When opts.array_header is true, space for an array header is
+-- reserved and <key_writer>:finish() fills it with the number
+-- of written keys.
+local function key_writer(self, ibuf, opts)
+    if type(ibuf) ~= 'cdata' or (opts ~= nil and type(opts) ~= 'table') then
+        error('Usage: key_def:key_writer(ibuf[, {array_header = ' ..
+              '<boolean>}])', 2)
+    end
+    local header_pos
+    if opts ~= nil and opts.array_header then
+        header_pos = ibuf.wpos - ibuf.rpos
+        ibuf:alloc(ARRAY32_HEADER_SIZE)
+    end
+    return setmetatable({
+        keydef = self,
+        ibuf = ibuf,
+        count = 0,
+        header_pos = header_pos,
+    }, key_writer_mt)
+end
+
+-- }}} Key writer
 
 local methods = {
     ['extract_key'] = tuple_keydef.extract_key,
+    ['extract_key_into'] = tuple_keydef.extract_key_into,
+    ['key_writer'] = key_writer,
     ['compare'] = tuple_keydef.compare,
     ['compare_with_key'] = tuple_keydef.compare_with_key,
+    ['filter'] = tuple_keydef.filter,
     ['merge'] = tuple_keydef.merge,
     ['totable'] = tuple_keydef.totable,
     ['__serialize'] = tuple_keydef.totable,
+    ['sort_permutation'] = tuple_keydef.sort_permutation,
+    ['hash_partition'] = tuple_keydef.hash_partition,
+    ['quantiles'] = tuple_keydef.quantiles,
+    ['join'] = tuple_keydef.join,
+    ['key_block'] = tuple_keydef.key_block,
+    ['diff'] = tuple_keydef.diff,
+    ['build_bloom'] = tuple_keydef.build_bloom,
+    ['deserialize_bloom'] = tuple_keydef.deserialize_bloom,
+    ['hll'] = tuple_keydef.hll,
+    ['deserialize_hll'] = tuple_keydef.deserialize_hll,
+}
+
+-- A key definition with a multikey JSON path supports only
+-- these methods.
+local multikey_methods = {
+    ['extract_keys_multikey'] = internal.multikey_extract_keys,
+    ['compare_with_key_multikey'] = internal.multikey_compare_with_key,
+    ['totable'] = internal.multikey_totable,
+    ['__serialize'] = internal.multikey_totable,
+}
+
+local bloom_methods = {
+    ['maybe_contains'] = internal.bloom_maybe_contains,
+    ['maybe_contains_tuple'] = internal.bloom_maybe_contains_tuple,
+    ['serialize'] = internal.bloom_serialize,
+}
+
+local hll_methods = {
+    ['add'] = internal.hll_add,
+    ['add_many'] = internal.hll_add_many,
+    ['merge'] = internal.hll_merge,
+    ['estimate'] = internal.hll_estimate,
+    ['serialize'] = internal.hll_serialize,
+}
+
+local key_block_get = internal.key_block_get
+
+local function key_block_next(self, pos)
+    pos = pos + 1
+    local key = key_block_get(self, pos)
+    if key == nil then
+        return nil
+    end
+    return pos, key
+end
+
+local key_block_methods = {
+    ['lower_bound'] = internal.key_block_lower_bound,
+    ['find'] = internal.key_block_find,
+    ['get'] = key_block_get,
+    ['len'] = internal.key_block_len,
+    ['bytes_per_key'] = internal.key_block_bytes_per_key,
+    ['pairs'] = function(self) return key_block_next, self, 0 end,
 }
 
 -- ffi.metatype() succeeds only when called the first time.
@@ -31,3 +156,32 @@ ffi.metatype(tuple_keydef_t, {
     end,
     __tostring = function(self) return '<struct tuple_keydef *>' end,
 })
+
+ffi.metatype(tuple_keydef_multikey_t, {
+    __index = function(self, key)
+        return multikey_methods[key]
+    end,
+    __tostring = function(self) return '<struct tuple_keydef_multikey *>' end,
+})
+
+ffi.metatype(tuple_keydef_bloom_t, {
+    __index = function(self, key)
+        return bloom_methods[key]
+    end,
+    __tostring = function(self) return '<struct tuple_keydef_bloom *>' end,
+})
+
+ffi.metatype(tuple_keydef_hll_t, {
+    __index = function(self, key)
+        return hll_methods[key]
+    end,
+    __tostring = function(self) return '<struct tuple_keydef_hll *>' end,
+})
+
+ffi.metatype(tuple_keydef_key_block_t, {
+    __index = function(self, key)
+        return key_block_methods[key]
+    end,
+    __len = internal.key_block_len,
+    __tostring = function(self) return '<struct tuple_keydef_key_block *>' end,
+})
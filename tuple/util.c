@@ -47,7 +47,7 @@
  * @return  string index or hmax if the string is not found.
  */
 uint32_t
-strnindex(const char **haystack, const char *needle, uint32_t len,
+strnindex(const char *const *haystack, const char *needle, uint32_t len,
 	  uint32_t hmax)
 {
 	if (len == 0)
@@ -59,3 +59,74 @@ strnindex(const char **haystack, const char *needle, uint32_t len,
 	}
 	return hmax;
 }
+
+static inline void
+swap_items(char *a, char *b, size_t size)
+{
+	for (size_t i = 0; i < size; ++i) {
+		char tmp = a[i];
+		a[i] = b[i];
+		b[i] = tmp;
+	}
+}
+
+/** Use insertion sort for partitions of this size or less. */
+enum { QSORT_ARG_INSERTION_MAX = 7 };
+
+void
+qsort_arg(void *base, size_t nmemb, size_t size,
+	  int (*cmp)(const void *, const void *, void *), void *arg)
+{
+	char *a = base;
+	while (nmemb > QSORT_ARG_INSERTION_MAX) {
+		/* Move a median of three to the first position. */
+		char *mid = a + (nmemb / 2) * size;
+		char *last = a + (nmemb - 1) * size;
+		if (cmp(mid, a, arg) < 0)
+			swap_items(mid, a, size);
+		if (cmp(last, mid, arg) < 0) {
+			swap_items(last, mid, size);
+			if (cmp(mid, a, arg) < 0)
+				swap_items(mid, a, size);
+		}
+		swap_items(a, mid, size);
+
+		/* Hoare partitioning around a[0]. */
+		char *end = a + nmemb * size;
+		char *i = a;
+		char *j = end;
+		for (;;) {
+			do {
+				i += size;
+			} while (i < end && cmp(i, a, arg) < 0);
+			do {
+				j -= size;
+			} while (cmp(j, a, arg) > 0);
+			if (i >= j)
+				break;
+			swap_items(i, j, size);
+		}
+		swap_items(a, j, size);
+
+		/*
+		 * Recurse into the smaller part and loop over the
+		 * larger one to bound the stack depth.
+		 */
+		size_t left = (j - a) / size;
+		size_t right = nmemb - left - 1;
+		if (left < right) {
+			qsort_arg(a, left, size, cmp, arg);
+			a = j + size;
+			nmemb = right;
+		} else {
+			qsort_arg(j + size, right, size, cmp, arg);
+			nmemb = left;
+		}
+	}
+
+	char *end = a + nmemb * size;
+	for (char *p = a + size; p < end; p += size) {
+		for (char *q = p; q > a && cmp(q - size, q, arg) > 0; q -= size)
+			swap_items(q, q - size, size);
+	}
+}
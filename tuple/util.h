@@ -31,6 +31,7 @@
  * SUCH DAMAGE.
  */
 
+#include <stddef.h>
 #include <stdint.h>
 
 #if defined(__cplusplus)
@@ -46,9 +47,35 @@ extern "C" {
 #endif
 
 uint32_t
-strnindex(const char **haystack, const char *needle, uint32_t len,
+strnindex(const char *const *haystack, const char *needle, uint32_t len,
 	  uint32_t hmax);
 
+/**
+ * qsort() with an extra argument for the comparator.
+ *
+ * qsort_r() is not portable: glibc and BSD have different
+ * argument orders.
+ */
+void
+qsort_arg(void *base, size_t nmemb, size_t size,
+	  int (*cmp)(const void *, const void *, void *), void *arg);
+
+/**
+ * xorshift64* pseudo random number generator.
+ *
+ * @a state must not be zero.
+ */
+static inline uint64_t
+xorshift64star(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
 #if defined(__cplusplus)
 } /* extern "C" */
 #endif /* defined(__cplusplus) */